@@ -18,6 +18,7 @@
 */
 
 #include "CuriePME.h"
+#include "pme_log.h"
 
 static uint16_t nsr_save = 0;
 
@@ -54,9 +55,55 @@ void CuriePME_configure( 	uint16_t global_context,
 // clear all commits in the network and make it ready to learn
 void CuriePME_forget( void )
 {
+	CuriePME_endTransfer();
 	regWrite16( FORGET_NCOUNT, 0 );
 }
 
+// mark --vector broadcast--
+
+// The component registers are 16-bits wide and take one component per
+// store, so the broadcast cannot be packed. Instead the loop is unrolled
+// and the common vector lengths get a fixed-length copy the compiler can
+// fully schedule.
+static inline void bcast4(const uint8_t *vector)
+{
+	regWrite16( COMP, vector[0] );
+	regWrite16( COMP, vector[1] );
+	regWrite16( COMP, vector[2] );
+	regWrite16( LCOMP, vector[3] );
+}
+
+static inline void bcastN(const uint8_t *vector, int32_t length)
+{
+	const int32_t last = length - 1;
+	int32_t i = 0;
+
+	for( ; i + 4 <= last; i += 4 )
+	{
+		regWrite16( COMP, vector[i] );
+		regWrite16( COMP, vector[i + 1] );
+		regWrite16( COMP, vector[i + 2] );
+		regWrite16( COMP, vector[i + 3] );
+	}
+	for( ; i < last; i++ )
+	{
+		regWrite16( COMP, vector[i] );
+	}
+
+	regWrite16( LCOMP, vector[last] );
+}
+
+// shared by learn, classify, bcast_vector and writeVector
+static void bcastVector(const uint8_t *vector, int32_t length)
+{
+	if( length == maxVectorSize )
+		bcastN( vector, maxVectorSize );
+	else if( length == 4 )
+		bcast4( vector );
+	else if( length > 0 )
+		bcastN( vector, length );
+}
+
 // mark --learn and classify--
 
 uint16_t CuriePME_learn(uint8_t *pattern_vector, int32_t vector_length, uint16_t category)
@@ -64,32 +111,23 @@ uint16_t CuriePME_learn(uint8_t *pattern_vector, int32_t vector_length, uint16_t
 	if( vector_length > maxVectorSize )
 		vector_length = maxVectorSize;
 
-	for( int i = 0; i < vector_length -1; i++ )
-	{
-	 	regWrite16( COMP , pattern_vector[i] );
-	}
-
-	regWrite16( LCOMP, pattern_vector[ vector_length - 1 ] );
+	bcastVector( pattern_vector, vector_length );
 
     /* Mask off the 15th bit-- valid categories range from 1-32766,
      * and bit 15 is used to indicate if a firing neuron has degenerated */
 	regWrite16(CAT, (regRead16(CAT) & ~CAT_CATEGORY) | (category & CAT_CATEGORY));
-	return regRead16( FORGET_NCOUNT );
+
+	uint16_t ncount = regRead16( FORGET_NCOUNT );
+	PME_TRACE_EVENT( PME_TRACE_LEARN, category, ncount );
+	return ncount;
 
 }
 
 uint16_t CuriePME_classify(uint8_t *pattern_vector, int32_t vector_length)
 {
-	uint8_t *current_vector = pattern_vector;
-	uint8_t index = 0;
-
 	if (vector_length > maxVectorSize) return -1;
 
-	for (index = 0; index < (vector_length - 1); index++)
-	{
-		regWrite16(COMP, current_vector[index]);
-	}
-	regWrite16( LCOMP , current_vector[vector_length - 1] );
+	bcastVector(pattern_vector, vector_length);
 
 	regRead16(IDX_DIST); //Sort by distance by David Florey
 
@@ -98,17 +136,10 @@ uint16_t CuriePME_classify(uint8_t *pattern_vector, int32_t vector_length)
 
 void CuriePME_bcast_vector(uint8_t *pattern_vector, int32_t vector_length)
 {
-	uint8_t *current_vector = pattern_vector;
-	uint8_t index = 0;
-
 	if (vector_length > maxVectorSize)
 		vector_length = maxVectorSize;
 
-	for (index = 0; index < (vector_length - 1); index++)
-	{
-		regWrite16(COMP, current_vector[index]);
-	}
-	regWrite16( LCOMP , current_vector[vector_length - 1] );
+	bcastVector(pattern_vector, vector_length);
 }
 
 uint16_t CuriePME_classify_next(uint16_t *distance, uint16_t *nid)
@@ -125,22 +156,68 @@ uint16_t CuriePME_classify_next(uint16_t *distance, uint16_t *nid)
 	return category;
 }
 
-// write vector is used for kNN recognition and does not alter
-// the CAT register, which moves the chain along.
-uint16_t CuriePME_writeVector(uint8_t *pattern_vector, int32_t vector_length)
+uint16_t CuriePME_classify_all(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t *distance, uint16_t *nid)
 {
+	classifyResult best;
 
+	if (CuriePME_classify_topk(pattern_vector, vector_length, 1, &best) == 0)
+	{
+		if (distance)
+			*distance = 0xFFFF;
+		if (nid)
+			*nid = 0;
+		return noMatch;
+	}
 
-	uint8_t *current_vector = pattern_vector;
-	uint8_t index = 0;
+	if (distance)
+		*distance = best.distance;
+	if (nid)
+		*nid = best.nid;
 
-	if (vector_length > maxVectorSize) return -1;
+	return best.category;
+}
+
+uint16_t CuriePME_classify_topk(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t k, classifyResult *results)
+{
+	uint16_t count = 0;
+
+	if (vector_length > maxVectorSize || vector_length <= 0)
+		return 0;
 
-	for (index = 0; index < (vector_length - 1); index++)
+	PME_TRACE_EVENT(PME_TRACE_VECTOR, vector_length, pattern_vector[0]);
+	bcastVector(pattern_vector, vector_length);
+
+	// the PME hands out firing neurons in order of increasing distance;
+	// DIST has to be read before CAT, and NID after CAT
+	while (count < k)
 	{
-		regWrite16(COMP, current_vector[index]);
+		uint16_t distance = regRead16(IDX_DIST);
+		uint16_t category = regRead16(CAT) & CAT_CATEGORY;
+
+		if (category == noMatch)
+			break;
+
+		results[count].distance = distance;
+		results[count].category = category;
+		results[count].nid = regRead16(NID);
+		count++;
 	}
-	regWrite16( LCOMP , current_vector[vector_length - 1] );
+
+	PME_TRACE_EVENT(PME_TRACE_CLASSIFY, count ? results[0].category : noMatch,
+		count ? results[0].distance : 0xFFFF);
+
+	return count;
+}
+
+// write vector is used for kNN recognition and does not alter
+// the CAT register, which moves the chain along.
+uint16_t CuriePME_writeVector(uint8_t *pattern_vector, int32_t vector_length)
+{
+	if (vector_length > maxVectorSize) return -1;
+
+	bcastVector(pattern_vector, vector_length);
 
 	return  0;
 
@@ -149,8 +226,6 @@ uint16_t CuriePME_writeVector(uint8_t *pattern_vector, int32_t vector_length)
 // retrieve the data of a specific neuron element by ID, between 1 and 128.
 uint16_t CuriePME_readNeuron( int32_t neuronID, neuronData *data_array)
 {
-	uint16_t dummy = 0;
-
 	// range check the ID - technically, this should be an error.
 
 	if( neuronID < firstNeuronID )
@@ -165,8 +240,8 @@ uint16_t CuriePME_readNeuron( int32_t neuronID, neuronData *data_array)
 
 	for( int i = 0; i < (neuronID -1); i++)
 	{
-
-		dummy = regRead16( CAT );
+		// reading CAT moves the chain to the next neuron
+		regRead16( CAT );
 	}
 
 	// retrieve the data using the iterateToSave method
@@ -181,9 +256,26 @@ uint16_t CuriePME_readNeuron( int32_t neuronID, neuronData *data_array)
 
 // mark --save and restore network--
 
+// Bulk transfers leave the chain in save/restore mode between calls, so a
+// transfer in chunks walks it once: a call that starts where the previous
+// one stopped carries on from there.
+#define NO_TRANSFER 0xFFFF
+static uint16_t transfer_next = NO_TRANSFER;  // chain position
+static uint16_t transfer_committed;           // committed count meanwhile
+static uint8_t transfer_import;
+
+void CuriePME_endTransfer(void)
+{
+	if( transfer_next == NO_TRANSFER )
+		return;
+	transfer_next = NO_TRANSFER;
+	CuriePME_endSaveMode();
+}
+
 // save and restore knowledge
 void CuriePME_beginSaveMode(void)
 {
+	CuriePME_endTransfer();
 	nsr_save = regRead16(NSR);
 
 	// set save/restore mode in the NSR
@@ -192,14 +284,19 @@ void CuriePME_beginSaveMode(void)
 	regWrite16( RSTCHAIN, 0);
 }
 
-// pass the function a structure to save data into
-uint16_t CuriePME_iterateNeuronsToSave(neuronData *array )
+// read the neuron the chain points at, then move the chain along.
+// Only the first length components are read, the rest are cleared.
+static uint16_t saveNeuron(neuronData *array, int32_t length)
 {
 	array->context =  regRead16( NCR );
-	for( int i=0; i < saveRestoreSize; i++)
+	for( int i=0; i < length; i++)
 	{
 		array->vector[i] = regRead16(COMP);
 	}
+	for( int i=length; i < saveRestoreSize; i++)
+	{
+		array->vector[i] = 0;
+	}
 
 	array->influence = regRead16( AIF );
 	array->minInfluence = regRead16( MINIF );
@@ -208,6 +305,32 @@ uint16_t CuriePME_iterateNeuronsToSave(neuronData *array )
 	return array->category;
 }
 
+// write the neuron the chain points at, writing CAT commits it and moves
+// the chain along. Only the first length components come from array, the
+// rest are written as 0 so nothing is left over from the previous neuron.
+static void restoreNeuron(const neuronData *array, int32_t length)
+{
+	regWrite16( NCR, array->context  );
+	for( int i=0; i < length; i++)
+	{
+		regWrite16(COMP, array->vector[i]);
+	}
+	for( int i=length; i < saveRestoreSize; i++)
+	{
+		regWrite16(COMP, 0);
+	}
+
+	regWrite16( AIF, array->influence );
+	regWrite16( MINIF, array->minInfluence );
+	regWrite16( CAT, array->category );
+}
+
+// pass the function a structure to save data into
+uint16_t CuriePME_iterateNeuronsToSave(neuronData *array )
+{
+	return saveNeuron( array, saveRestoreSize );
+}
+
 void CuriePME_endSaveMode(void)
 {
 	//restore the network to how we found it.
@@ -217,6 +340,7 @@ void CuriePME_endSaveMode(void)
 
 void CuriePME_beginRestoreMode(void)
 {
+	CuriePME_endTransfer();
 	nsr_save = regRead16(NSR);
 
 	CuriePME_forget();
@@ -228,15 +352,7 @@ void CuriePME_beginRestoreMode(void)
 
 uint16_t CuriePME_iterateNeuronsToRestore(neuronData *array  )
 {
-	regWrite16( NCR, array->context  );
-	for( int i=0; i < saveRestoreSize; i++)
-	{
-		regWrite16(COMP, array->vector[i]);
-	}
-
-	regWrite16( AIF, array->influence );
-	regWrite16( MINIF, array->minInfluence );
-	regWrite16( CAT, array->category );
+	restoreNeuron( array, saveRestoreSize );
 
 	return 0;
 }
@@ -247,6 +363,137 @@ void CuriePME_endRestoreMode(void)
 	regWrite16(NSR, (nsr_save & ~NSR_NET_MODE));
 }
 
+// overwrite a committed neuron by ID, between 1 and 128, leaving the rest
+// of the network as it is
+uint16_t CuriePME_writeNeuron( int32_t neuronID, const neuronData *data_array)
+{
+	if( neuronID < firstNeuronID || neuronID > CuriePME_getCommittedCount() )
+		return 0;
+
+	CuriePME_beginSaveMode();
+
+	// reading CAT moves the chain to the next neuron
+	for( int i = 0; i < (neuronID - 1); i++)
+		regRead16( CAT );
+
+	restoreNeuron( data_array, saveRestoreSize );
+
+	CuriePME_endRestoreMode();
+
+	return neuronID;
+}
+
+// mark --bulk knowledge transfer--
+
+// Copy up to max_neurons committed neurons, starting with neuron first, into
+// data_array, reading vector_length components of each. The transfer stays
+// open for a call at first + the returned count until the last neuron has
+// been read or CuriePME_endTransfer().
+uint16_t CuriePME_exportKnowledge( neuronData *data_array, uint16_t first,
+		uint16_t max_neurons, int32_t vector_length )
+{
+	uint16_t count = 0;
+
+	if( vector_length > saveRestoreSize )
+		vector_length = saveRestoreSize;
+	if( vector_length < 0 )
+		vector_length = 0;
+
+	if( transfer_next != first || transfer_import )
+	{
+		uint16_t committed = CuriePME_getCommittedCount();
+		if( first >= committed )
+		{
+			CuriePME_endTransfer();
+			return 0;
+		}
+
+		CuriePME_beginSaveMode();
+
+		// reading CAT moves the chain to the next neuron
+		for( int i = 0; i < first; i++ )
+			regRead16( CAT );
+
+		transfer_committed = committed;
+		transfer_import = 0;
+	}
+
+	if( max_neurons > transfer_committed - first )
+		max_neurons = transfer_committed - first;
+
+	while( count < max_neurons )
+	{
+		if( (saveNeuron( &data_array[count], vector_length ) & CAT_CATEGORY) == 0 )
+			break;
+		count++;
+	}
+
+	transfer_next = first + count;
+	if( count < max_neurons || transfer_next >= transfer_committed )
+		CuriePME_endTransfer();
+
+	return count;
+}
+
+// Write count neurons from data_array into the chain starting at neuron
+// first, taking vector_length components of each and zeroing the rest.
+// first == 0 replaces the network, otherwise first must not be past the last
+// committed neuron. The transfer stays open for a call at first + count
+// until CuriePME_endTransfer().
+// Returns the committed count.
+uint16_t CuriePME_importKnowledge( const neuronData *data_array, uint16_t first,
+		uint16_t count, int32_t vector_length )
+{
+	if( vector_length > saveRestoreSize )
+		vector_length = saveRestoreSize;
+	if( vector_length < 0 )
+		vector_length = 0;
+
+	if( transfer_next != first || !transfer_import )
+	{
+		uint16_t committed = CuriePME_getCommittedCount();
+		if( first > committed )
+		{
+			CuriePME_endTransfer();
+			return committed;
+		}
+
+		if( first == 0 )
+		{
+			CuriePME_beginRestoreMode();
+			committed = 0;
+		}
+		else
+		{
+			CuriePME_beginSaveMode();
+			for( int i = 0; i < first; i++ )
+				regRead16( CAT );
+		}
+
+		transfer_committed = committed;
+		transfer_import = 1;
+	}
+
+	if( count > maxNeurons - first )
+		count = maxNeurons - first;
+
+	for( int i = 0; i < count; i++ )
+	{
+		restoreNeuron( &data_array[i], vector_length );
+		// writing a category commits the neurons up to this one
+		if( (data_array[i].category & CAT_CATEGORY) &&
+			first + i >= transfer_committed )
+			transfer_committed = first + i + 1;
+	}
+
+	uint16_t committed = transfer_committed;
+	transfer_next = first + count;
+	if( transfer_next >= maxNeurons )
+		CuriePME_endTransfer();
+
+	return committed;
+}
+
 // mark -- getter and setters--
 
 PATTERN_MATCHING_DISTANCE_MODE // L1 or LSup
@@ -293,10 +540,13 @@ void CuriePME_setNeuronContext(uint16_t context)
 
 // NOTE: getCommittedCount() will give inaccurate value if the network is in Save/Restore mode.
 // It should not be called between the beginSaveMode() and endSaveMode() or between
-// beginRestoreMode() and endRestoreMode()
+// beginRestoreMode() and endRestoreMode(). During a bulk transfer the count
+// is tracked instead.
 uint16_t
 CuriePME_getCommittedCount( void )
 {
+	if( transfer_next != NO_TRANSFER )
+		return transfer_committed;
 	return (getFORGET_NCOUNT() & 0xff );
 }
 
@@ -54,6 +54,14 @@ typedef struct neuronData
 
 } neuronData;
 
+// one firing neuron, as returned by CuriePME_classify_topk
+typedef struct classifyResult
+{
+	uint16_t  category;
+	uint16_t  distance;
+	uint16_t  nid;
+} classifyResult;
+
 
 // Default initializer
 void CuriePME_begin(void);
@@ -71,7 +79,16 @@ uint16_t CuriePME_classify(uint8_t *pattern_vector, int32_t vector_length);
 void CuriePME_bcast_vector(uint8_t *pattern_vector, int32_t vector_length);
 uint16_t CuriePME_classify_next(uint16_t *distance, uint16_t *nid);
 
+// best match with its distance and neuron ID, noMatch if nothing fired
+uint16_t CuriePME_classify_all(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t *distance, uint16_t *nid);
+
+// up to k firing neurons ordered by distance, returns the number found
+uint16_t CuriePME_classify_topk(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t k, classifyResult *results);
+
 uint16_t CuriePME_readNeuron( int32_t neuronID, neuronData *data_array);
+uint16_t CuriePME_writeNeuron( int32_t neuronID, const neuronData *data_array);
 
 // save and restore knowledge
 void CuriePME_beginSaveMode(void);  // saves the contents of the NSR register
@@ -82,6 +99,20 @@ void CuriePME_beginRestoreMode(void);
 uint16_t CuriePME_iterateNeuronsToRestore( neuronData *data_array );
 void CuriePME_endRestoreMode(void);
 
+// bulk save and restore, one pass over the chain starting at neuron first
+// (0 based). Only vector_length components per neuron are transferred, the
+// rest read back as 0 on export and are written as 0 on import. Importing
+// at first == 0 replaces the network.
+//
+// A transfer in chunks walks the chain once: the chain stays in save/restore
+// mode for a call that continues where the previous one stopped. Call
+// CuriePME_endTransfer() before using the PME in any other way.
+uint16_t CuriePME_exportKnowledge( neuronData *data_array, uint16_t first,
+		uint16_t max_neurons, int32_t vector_length );
+uint16_t CuriePME_importKnowledge( const neuronData *data_array, uint16_t first,
+		uint16_t count, int32_t vector_length );
+void CuriePME_endTransfer(void);
+
 //getter and setters
 PATTERN_MATCHING_DISTANCE_MODE CuriePME_getDistanceMode(void);
 void CuriePME_setDistanceMode( PATTERN_MATCHING_DISTANCE_MODE mode);
@@ -100,7 +131,7 @@ void CuriePME_setClassifierMode( PATTERN_MATCHING_CLASSIFICATION_MODE mode );
 
 // write vector is used for kNN recognition and does not alter
 // the CAT register, which moves the chain along.
-uint16_t writeVector(uint8_t *pattern_vector, int32_t vector_length);
+uint16_t CuriePME_writeVector(uint8_t *pattern_vector, int32_t vector_length);
 
 // raw register access - not recommended.
 uint16_t getNCR( void );
@@ -154,6 +185,27 @@ typedef enum
 	NSR_UNCERTAIN_FLAG = 0x0004,// Indicates uncertain identification
 } Masks;
 
+// host builds have no accelerator, always run them on the software model
+#if !defined(__ZEPHYR__) && !defined(CURIE_PME_EMULATOR)
+#define CURIE_PME_EMULATOR
+#endif
+
+#ifdef CURIE_PME_EMULATOR
+// software model of the register block, see CuriePME_emu.c
+uint16_t CuriePME_emu_read16(Registers reg);
+void CuriePME_emu_write16(Registers reg, uint16_t value);
+void CuriePME_emu_reset(void); // power-on state, all neurons cleared
+
+static inline uint16_t regRead16 (Registers reg)
+{
+	return CuriePME_emu_read16(reg);
+}
+
+static inline void regWrite16 (Registers reg, uint16_t value)
+{
+	CuriePME_emu_write16(reg, value);
+}
+#else
 // all pattern matching accelerator registers are 16-bits wide, memory-addressed
 // define efficient inline register access
 inline volatile uint16_t *regAddress (Registers reg)
@@ -170,6 +222,7 @@ inline void regWrite16 (Registers reg, uint16_t value)
 {
 	*regAddress(reg) = value;
 }
+#endif // CURIE_PME_EMULATOR
 #if 0
 inline void regWrite16 (Registers reg, uint8_t value)
 {
@@ -0,0 +1,386 @@
+/*
+   Copyright (c) 2016 Intel Corporation.  All rights reserved.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+// Software model of the pattern matching accelerator register block.
+//
+// Built instead of the MMIO window when CURIE_PME_EMULATOR is defined, so the
+// CuriePME_* functions (and everything above them) run unchanged on a host.
+// The model follows the register semantics the driver relies on:
+//
+//  - LR mode: COMP/LCOMP broadcast a vector, LCOMP evaluates all committed
+//    neurons of the global context. IDX_DIST/CAT/NID then pop the firing
+//    neurons in order of increasing distance. Writing CAT learns.
+//  - SR mode: RSTCHAIN points at the first neuron, NCR/COMP/AIF/MINIF access
+//    the pointed neuron and CAT moves the chain along (committing on write).
+
+#include <string.h>
+
+#include "CuriePME.h"
+
+#define EMU_NO_NEURON     0xFFFF
+#define EMU_DEFAULT_MINIF 2
+#define EMU_DEFAULT_MAXIF 0x4000
+
+typedef struct emuNeuron
+{
+	uint16_t  context;		// NCR_CONTEXT | NCR_NORM
+	uint16_t  influence;
+	uint16_t  minInfluence;
+	uint16_t  category;		// CAT_CATEGORY | CAT_DEGEN
+	uint16_t  distance;		// distance to the last broadcast vector
+	uint8_t   firing;
+	uint8_t   vector[128];
+} emuNeuron;
+
+static emuNeuron neurons[128];
+static uint16_t committed = 0;
+
+static uint16_t gcr = 1;
+static uint16_t nsr = 0;
+static uint16_t ncr = 1;	// context of the ready-to-learn neuron
+static uint16_t minif = EMU_DEFAULT_MINIF;
+static uint16_t maxif = EMU_DEFAULT_MAXIF;
+
+static uint8_t  bcast[128];	// vector being broadcast
+static uint16_t comp_index = 0;
+static uint16_t bcast_length = 0;
+
+static uint16_t chain = 0;	// SR mode neuron pointer
+static uint16_t last_nid = 0;
+
+static int neuronActive(const emuNeuron *n)
+{
+	uint16_t context = gcr & GCR_GLOBAL;
+
+	// context 0 enables all neurons; NCR_NORM shares the context bits of
+	// the NCR but only selects the distance
+	return (context == 0 ||
+		(n->context & NCR_CONTEXT & ~NCR_NORM) == (context & ~NCR_NORM));
+}
+
+static uint16_t neuronDistance(const emuNeuron *n)
+{
+	uint32_t dist = 0;
+
+	for (int i = 0; i < bcast_length; i++)
+	{
+		int d = (int)bcast[i] - (int)n->vector[i];
+		if (d < 0)
+			d = -d;
+
+		if (n->context & NCR_NORM)
+		{
+			if ((uint32_t)d > dist)
+				dist = d;
+		}
+		else
+			dist += d;
+	}
+
+	return (dist > 0xFFFE) ? 0xFFFE : (uint16_t)dist;
+}
+
+// evaluate the committed neurons against the broadcast vector
+static void evaluate(void)
+{
+	uint16_t firstCat = 0;
+	int uncertain = 0;
+	int found = 0;
+
+	nsr &= ~(NSR_ID_FLAG | NSR_UNCERTAIN_FLAG);
+
+	for (int i = 0; i < committed; i++)
+	{
+		emuNeuron *n = &neurons[i];
+
+		n->firing = 0;
+		if (!neuronActive(n))
+			continue;
+
+		n->distance = neuronDistance(n);
+		if ((nsr & NSR_CLASS_MODE) || n->distance < n->influence)
+		{
+			n->firing = 1;
+			if (!found)
+				firstCat = n->category & CAT_CATEGORY;
+			else if ((n->category & CAT_CATEGORY) != firstCat)
+				uncertain = 1;
+			found = 1;
+		}
+	}
+
+	if (found)
+		nsr |= uncertain ? NSR_UNCERTAIN_FLAG : NSR_ID_FLAG;
+}
+
+// next firing neuron by increasing distance, ties resolved by chain order
+static int nextFiring(void)
+{
+	int best = -1;
+
+	for (int i = 0; i < committed; i++)
+	{
+		if (neurons[i].firing &&
+			(best < 0 || neurons[i].distance < neurons[best].distance))
+			best = i;
+	}
+
+	return best;
+}
+
+static void learn(uint16_t category)
+{
+	int recognized = 0;
+	uint16_t influence = maxif;
+	uint16_t degen = 0;
+
+	for (int i = 0; i < committed; i++)
+	{
+		emuNeuron *n = &neurons[i];
+
+		if (!neuronActive(n))
+			continue;
+
+		n->distance = neuronDistance(n);
+
+		if ((n->category & CAT_CATEGORY) == category)
+		{
+			if (n->distance < n->influence)
+				recognized = 1;
+			continue;
+		}
+
+		// the closest neuron of another category limits the new neuron
+		if (n->distance < influence)
+			influence = n->distance;
+
+		// shrink firing neurons of another category
+		if (n->distance < n->influence)
+		{
+			if (n->distance <= n->minInfluence)
+			{
+				n->influence = n->minInfluence;
+				n->category |= CAT_DEGEN;
+			}
+			else
+				n->influence = n->distance;
+		}
+	}
+
+	// category 0 is a counter example, it only shrinks neurons
+	if (category == 0 || recognized || committed >= maxNeurons)
+		return;
+
+	if (influence <= minif)
+	{
+		influence = minif;
+		degen = CAT_DEGEN;
+	}
+
+	emuNeuron *n = &neurons[committed++];
+
+	memset(n->vector, 0, sizeof(n->vector));
+	memcpy(n->vector, bcast, bcast_length);
+	n->context = (ncr & NCR_CONTEXT) | ((gcr & GCR_DIST) ? NCR_NORM : 0);
+	n->influence = influence;
+	n->minInfluence = minif;
+	n->category = category | degen;
+	n->firing = 0;
+}
+
+void CuriePME_emu_reset(void)
+{
+	memset(neurons, 0, sizeof(neurons));
+	committed = 0;
+	gcr = 1;
+	nsr = 0;
+	ncr = 1;
+	minif = EMU_DEFAULT_MINIF;
+	maxif = EMU_DEFAULT_MAXIF;
+	comp_index = 0;
+	bcast_length = 0;
+	chain = 0;
+	last_nid = 0;
+}
+
+uint16_t CuriePME_emu_read16(Registers reg)
+{
+	int sr = (nsr & NSR_NET_MODE) != 0;
+	int i;
+
+	switch (reg)
+	{
+	case NCR:
+		if (sr)
+			return (chain < maxNeurons) ? neurons[chain].context : 0;
+		return ncr;
+	case COMP:
+		if (sr && chain < maxNeurons && comp_index < maxVectorSize)
+			return neurons[chain].vector[comp_index++];
+		return 0;
+	case IDX_DIST:
+		if (sr)
+			return comp_index;
+		i = nextFiring();
+		return (i < 0) ? EMU_NO_NEURON : neurons[i].distance;
+	case CAT:
+		if (sr)
+		{
+			uint16_t cat = 0;
+			if (chain < committed)
+				cat = neurons[chain].category;
+			if (chain < maxNeurons)
+				chain++;
+			comp_index = 0;
+			return cat;
+		}
+		// reading the category withdraws the neuron from the firing list
+		i = nextFiring();
+		if (i < 0)
+			return EMU_NO_NEURON;
+		neurons[i].firing = 0;
+		last_nid = i + 1;
+		return neurons[i].category;
+	case AIF:
+		if (sr)
+			return (chain < maxNeurons) ? neurons[chain].influence : 0;
+		return last_nid ? neurons[last_nid - 1].influence : 0;
+	case MINIF:
+		if (sr)
+			return (chain < maxNeurons) ? neurons[chain].minInfluence : 0;
+		return minif;
+	case MAXIF:
+		return maxif;
+	case NID:
+		return sr ? chain + 1 : last_nid;
+	case GCR:
+		return gcr;
+	case RSTCHAIN:
+		return 0;
+	case NSR:
+		return nsr;
+	case FORGET_NCOUNT:
+		return committed;
+	default:
+		return 0;
+	}
+}
+
+void CuriePME_emu_write16(Registers reg, uint16_t value)
+{
+	int sr = (nsr & NSR_NET_MODE) != 0;
+
+	switch (reg)
+	{
+	case NCR:
+		if (!sr)
+			ncr = value;
+		else if (chain < maxNeurons)
+			neurons[chain].context = value & (NCR_CONTEXT | NCR_NORM);
+		break;
+	case COMP:
+	case LCOMP:
+		if (sr)
+		{
+			if (chain < maxNeurons && comp_index < maxVectorSize)
+				neurons[chain].vector[comp_index++] = (uint8_t)value;
+			break;
+		}
+		if (comp_index < maxVectorSize)
+			bcast[comp_index++] = (uint8_t)value;
+		if (reg == LCOMP)
+		{
+			bcast_length = comp_index;
+			comp_index = 0;
+			last_nid = 0;
+			evaluate();
+		}
+		break;
+	case IDX_DIST:
+		comp_index = (value < maxVectorSize) ? value : maxVectorSize - 1;
+		break;
+	case CAT:
+		if (sr)
+		{
+			if (chain < maxNeurons)
+			{
+				neurons[chain].category = value;
+				if ((value & CAT_CATEGORY) && chain >= committed)
+					committed = chain + 1;
+				chain++;
+			}
+			comp_index = 0;
+			break;
+		}
+		learn(value & CAT_CATEGORY);
+		break;
+	case AIF:
+		if (sr && chain < maxNeurons)
+			neurons[chain].influence = value;
+		break;
+	case MINIF:
+		if (sr && chain < maxNeurons)
+			neurons[chain].minInfluence = value;
+		else if (!sr)
+			minif = value;
+		break;
+	case MAXIF:
+		maxif = value;
+		break;
+	case TESTCOMP:
+		// writes the same component into every neuron
+		if (comp_index < maxVectorSize)
+		{
+			for (int i = 0; i < maxNeurons; i++)
+				neurons[i].vector[comp_index] = (uint8_t)value;
+			comp_index++;
+		}
+		break;
+	case TESTCAT:
+		for (int i = committed; i < maxNeurons; i++)
+			neurons[i].category = value;
+		comp_index = 0;
+		break;
+	case GCR:
+		gcr = value;
+		ncr = (ncr & ~NCR_CONTEXT) | (value & GCR_GLOBAL);
+		break;
+	case RSTCHAIN:
+		chain = 0;
+		comp_index = 0;
+		break;
+	case NSR:
+		nsr = value & (NSR_CLASS_MODE | NSR_NET_MODE);
+		comp_index = 0;
+		break;
+	case FORGET_NCOUNT:
+		memset(neurons, 0, sizeof(neurons));
+		committed = 0;
+		minif = EMU_DEFAULT_MINIF;
+		maxif = EMU_DEFAULT_MAXIF;
+		gcr = 1;
+		ncr = 1;
+		chain = 0;
+		comp_index = 0;
+		last_nid = 0;
+		break;
+	default:
+		break;
+	}
+}
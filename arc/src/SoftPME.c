@@ -0,0 +1,596 @@
+// Copyright (c) 2016, Intel Corporation.
+
+// Software pattern matching engine, see SoftPME.h.
+//
+// Neuron vectors are kept in one 32-byte aligned block, 128 bytes per
+// neuron, with the per-neuron registers next to it, so evaluating the
+// network is a linear sweep. The broadcast vector is zero padded to 128
+// bytes; components past the broadcast length are masked off in the
+// kernels, the same as the accelerator only compares what was broadcast.
+
+#include <string.h>
+
+#include "SoftPME.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define SOFT_NO_NEURON     0xFFFF
+#define SOFT_DEFAULT_MINIF 2
+#define SOFT_DEFAULT_MAXIF 0x4000
+
+typedef struct softNeuron
+{
+	uint16_t  context;		// NCR_CONTEXT | NCR_NORM
+	uint16_t  influence;
+	uint16_t  minInfluence;
+	uint16_t  category;		// CAT_CATEGORY | CAT_DEGEN
+} softNeuron;
+
+static uint8_t soft_vectors[SOFT_PME_MAX_NEURONS][128] __attribute__((aligned(32)));
+static softNeuron soft_neurons[SOFT_PME_MAX_NEURONS];
+static uint16_t soft_distance[SOFT_PME_MAX_NEURONS];
+static uint8_t soft_firing[SOFT_PME_MAX_NEURONS];
+static uint16_t committed = 0;
+
+static uint16_t gcr = 1;		// GCR_GLOBAL | GCR_DIST
+static uint16_t ncr = 1;		// context of the ready-to-learn neuron
+static uint16_t knn = 0;
+static uint16_t minif = SOFT_DEFAULT_MINIF;
+static uint16_t maxif = SOFT_DEFAULT_MAXIF;
+
+static uint8_t query[128] __attribute__((aligned(32)));
+static int32_t query_length = 0;
+
+static uint16_t chain = 0;		// save/restore neuron pointer
+static uint16_t last_nid = 0;
+
+// mark --distance kernels--
+
+// a and b are 128 byte, 32-byte aligned vectors, only the first length
+// components count
+#if defined(__AVX2__)
+static const uint8_t tail_mask[64] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static uint32_t distL1(const uint8_t *a, const uint8_t *b, int32_t length)
+{
+	__m256i sum = _mm256_setzero_si256();
+	int32_t i = 0;
+
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i va = _mm256_load_si256((const __m256i *)&a[i]);
+		__m256i vb = _mm256_load_si256((const __m256i *)&b[i]);
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+	}
+	if (i < length)
+	{
+		__m256i mask = _mm256_loadu_si256((const __m256i *)&tail_mask[32 - (length - i)]);
+		__m256i va = _mm256_and_si256(_mm256_load_si256((const __m256i *)&a[i]), mask);
+		__m256i vb = _mm256_and_si256(_mm256_load_si256((const __m256i *)&b[i]), mask);
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+	}
+
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+	return (uint32_t)_mm_cvtsi128_si32(s);
+}
+
+static uint32_t distLSUP(const uint8_t *a, const uint8_t *b, int32_t length)
+{
+	__m256i dmax = _mm256_setzero_si256();
+	int32_t i = 0;
+
+	for (; i < length; i += 32)
+	{
+		__m256i va = _mm256_load_si256((const __m256i *)&a[i]);
+		__m256i vb = _mm256_load_si256((const __m256i *)&b[i]);
+		// |a - b| as the larger of the two saturated differences
+		__m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+		if (i + 32 > length)
+			d = _mm256_and_si256(d, _mm256_loadu_si256((const __m256i *)&tail_mask[32 - (length - i)]));
+		dmax = _mm256_max_epu8(dmax, d);
+	}
+
+	__m128i m = _mm_max_epu8(_mm256_castsi256_si128(dmax), _mm256_extracti128_si256(dmax, 1));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 8));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+	return (uint32_t)_mm_cvtsi128_si32(m) & 0xFF;
+}
+#elif defined(__SSE2__)
+static const uint8_t tail_mask[32] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static uint32_t distL1(const uint8_t *a, const uint8_t *b, int32_t length)
+{
+	__m128i sum = _mm_setzero_si128();
+	int32_t i = 0;
+
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i va = _mm_load_si128((const __m128i *)&a[i]);
+		__m128i vb = _mm_load_si128((const __m128i *)&b[i]);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+	}
+	if (i < length)
+	{
+		__m128i mask = _mm_loadu_si128((const __m128i *)&tail_mask[16 - (length - i)]);
+		__m128i va = _mm_and_si128(_mm_load_si128((const __m128i *)&a[i]), mask);
+		__m128i vb = _mm_and_si128(_mm_load_si128((const __m128i *)&b[i]), mask);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+	}
+
+	sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+	return (uint32_t)_mm_cvtsi128_si32(sum);
+}
+
+static uint32_t distLSUP(const uint8_t *a, const uint8_t *b, int32_t length)
+{
+	__m128i m = _mm_setzero_si128();
+	int32_t i = 0;
+
+	for (; i < length; i += 16)
+	{
+		__m128i va = _mm_load_si128((const __m128i *)&a[i]);
+		__m128i vb = _mm_load_si128((const __m128i *)&b[i]);
+		// |a - b| as the larger of the two saturated differences
+		__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		if (i + 16 > length)
+			d = _mm_and_si128(d, _mm_loadu_si128((const __m128i *)&tail_mask[16 - (length - i)]));
+		m = _mm_max_epu8(m, d);
+	}
+
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 8));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+	return (uint32_t)_mm_cvtsi128_si32(m) & 0xFF;
+}
+#else
+static uint32_t distL1(const uint8_t *a, const uint8_t *b, int32_t length)
+{
+	uint32_t dist = 0;
+
+	for (int32_t i = 0; i < length; i++)
+		dist += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+	return dist;
+}
+
+static uint32_t distLSUP(const uint8_t *a, const uint8_t *b, int32_t length)
+{
+	uint32_t dist = 0;
+
+	for (int32_t i = 0; i < length; i++)
+	{
+		uint32_t d = (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+		if (d > dist)
+			dist = d;
+	}
+	return dist;
+}
+#endif
+
+static inline uint16_t neuronDistance(uint16_t n)
+{
+	uint32_t dist = (soft_neurons[n].context & NCR_NORM) ?
+		distLSUP(query, soft_vectors[n], query_length) :
+		distL1(query, soft_vectors[n], query_length);
+
+	return (dist > 0xFFFE) ? 0xFFFE : (uint16_t)dist;
+}
+
+static inline int neuronActive(uint16_t n)
+{
+	uint16_t context = gcr & GCR_GLOBAL;
+
+	// context 0 enables all neurons; NCR_NORM shares the context bits of
+	// the NCR, as in CuriePME_emu.c it only selects the distance
+	return (context == 0 || (soft_neurons[n].context & NCR_CONTEXT & ~NCR_NORM) ==
+		(context & ~NCR_NORM));
+}
+
+// mark --evaluation--
+
+static void setQuery(const uint8_t *vector, int32_t length)
+{
+	memcpy(query, vector, length);
+	memset(&query[length], 0, sizeof(query) - length);
+	query_length = length;
+	last_nid = 0;
+}
+
+// evaluate the committed neurons against the query, returns the closest
+// firing one (ties go to the lower neuron ID) or -1
+static int32_t evaluate(void)
+{
+	int32_t best = -1;
+
+	for (uint16_t i = 0; i < committed; i++)
+	{
+		soft_firing[i] = 0;
+		if (!neuronActive(i))
+			continue;
+
+		uint16_t dist = neuronDistance(i);
+		soft_distance[i] = dist;
+		if (knn || dist < soft_neurons[i].influence)
+		{
+			soft_firing[i] = 1;
+			if (best < 0 || dist < soft_distance[best])
+				best = i;
+		}
+	}
+
+	return best;
+}
+
+// next firing neuron by increasing distance, ties resolved by chain order
+static int32_t nextFiring(void)
+{
+	int32_t best = -1;
+
+	for (uint16_t i = 0; i < committed; i++)
+	{
+		if (soft_firing[i] && (best < 0 || soft_distance[i] < soft_distance[best]))
+			best = i;
+	}
+
+	return best;
+}
+
+// withdraw a neuron from the firing list, returns its category
+static uint16_t pop(int32_t n)
+{
+	if (n < 0)
+		return SOFT_NO_NEURON;
+
+	soft_firing[n] = 0;
+	last_nid = n + 1;
+	return soft_neurons[n].category;
+}
+
+// recognized and max_influence carry what the rest of a larger network
+// (see SoftPME_learn_bounded) has to say about the vector
+// returns 1 if the vector needed a new neuron but all are committed
+static int learn(uint16_t category, int recognized, uint16_t max_influence)
+{
+	uint16_t influence = (max_influence < maxif) ? max_influence : maxif;
+	uint16_t degen = 0;
+
+	for (uint16_t i = 0; i < committed; i++)
+	{
+		softNeuron *n = &soft_neurons[i];
+
+		if (!neuronActive(i))
+			continue;
+
+		uint16_t dist = neuronDistance(i);
+
+		if ((n->category & CAT_CATEGORY) == category)
+		{
+			if (dist < n->influence)
+				recognized = 1;
+			continue;
+		}
+
+		// the closest neuron of another category limits the new neuron
+		if (dist < influence)
+			influence = dist;
+
+		// shrink firing neurons of another category
+		if (dist < n->influence)
+		{
+			if (dist <= n->minInfluence)
+			{
+				n->influence = n->minInfluence;
+				n->category |= CAT_DEGEN;
+			}
+			else
+				n->influence = dist;
+		}
+	}
+
+	// category 0 is a counter example, it only shrinks neurons
+	if (category == 0 || recognized)
+		return 0;
+	if (committed >= SOFT_PME_MAX_NEURONS)
+		return 1;
+
+	if (influence <= minif)
+	{
+		influence = minif;
+		degen = CAT_DEGEN;
+	}
+
+	softNeuron *n = &soft_neurons[committed];
+
+	memcpy(soft_vectors[committed], query, sizeof(query));
+	n->context = (ncr & NCR_CONTEXT) | ((gcr & GCR_DIST) ? NCR_NORM : 0);
+	n->influence = influence;
+	n->minInfluence = minif;
+	n->category = category | degen;
+	soft_firing[committed] = 0;
+	committed++;
+	return 0;
+}
+
+// mark --learn and classify--
+
+void SoftPME_begin(void)
+{
+	SoftPME_forget();
+}
+
+void SoftPME_forget(void)
+{
+	memset(soft_vectors, 0, sizeof(soft_vectors));
+	memset(soft_neurons, 0, sizeof(soft_neurons));
+	memset(soft_firing, 0, sizeof(soft_firing));
+	committed = 0;
+	minif = SOFT_DEFAULT_MINIF;
+	maxif = SOFT_DEFAULT_MAXIF;
+	gcr = 1;
+	ncr = 1;
+	chain = 0;
+	last_nid = 0;
+}
+
+void SoftPME_configure(uint16_t global_context,
+		PATTERN_MATCHING_DISTANCE_MODE distance_mode,
+		PATTERN_MATCHING_CLASSIFICATION_MODE classification_mode,
+		uint16_t minAIF, uint16_t maxAIF)
+{
+	gcr = global_context | (distance_mode << 7);
+	ncr = (ncr & ~NCR_CONTEXT) | (gcr & GCR_GLOBAL);
+	// like CuriePME_configure, this can only turn KNN on
+	knn |= (classification_mode == KNN_Mode);
+	minif = minAIF;
+	maxif = maxAIF;
+}
+
+uint16_t SoftPME_learn(uint8_t *pattern_vector, int32_t vector_length, uint16_t category)
+{
+	if (vector_length > maxVectorSize)
+		vector_length = maxVectorSize;
+
+	if (vector_length > 0)
+		setQuery(pattern_vector, vector_length);
+	learn(category & CAT_CATEGORY, 0, SOFT_NO_NEURON);
+
+	return committed;
+}
+
+uint16_t SoftPME_learn_bounded(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t category, uint16_t max_influence, int recognized)
+{
+	if (vector_length > maxVectorSize)
+		vector_length = maxVectorSize;
+
+	if (vector_length > 0)
+		setQuery(pattern_vector, vector_length);
+	if (learn(category & CAT_CATEGORY, recognized, max_influence))
+		return SOFT_PME_FULL;
+
+	return committed;
+}
+
+uint16_t SoftPME_classify(uint8_t *pattern_vector, int32_t vector_length)
+{
+	if (vector_length > maxVectorSize) return -1;
+
+	if (vector_length > 0)
+		setQuery(pattern_vector, vector_length);
+
+	return pop(evaluate()) & CAT_CATEGORY;
+}
+
+uint16_t SoftPME_classify_next(uint16_t *distance, uint16_t *nid)
+{
+	int32_t next = nextFiring();
+
+	if (distance)
+		*distance = (next < 0) ? SOFT_NO_NEURON : soft_distance[next];
+
+	uint16_t category = pop(next) & CAT_CATEGORY;
+
+	if (nid)
+		*nid = last_nid;
+
+	return category;
+}
+
+uint16_t SoftPME_classify_all(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t *distance, uint16_t *nid)
+{
+	classifyResult best;
+
+	if (SoftPME_classify_topk(pattern_vector, vector_length, 1, &best) == 0)
+	{
+		if (distance)
+			*distance = 0xFFFF;
+		if (nid)
+			*nid = 0;
+		return noMatch;
+	}
+
+	if (distance)
+		*distance = best.distance;
+	if (nid)
+		*nid = best.nid;
+
+	return best.category;
+}
+
+uint16_t SoftPME_classify_topk(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t k, classifyResult *results)
+{
+	uint16_t count = 0;
+
+	if (vector_length > maxVectorSize || vector_length <= 0)
+		return 0;
+
+	setQuery(pattern_vector, vector_length);
+
+	for (int32_t n = evaluate(); n >= 0 && count < k; n = nextFiring())
+	{
+		results[count].distance = soft_distance[n];
+		results[count].category = pop(n) & CAT_CATEGORY;
+		results[count].nid = last_nid;
+		count++;
+	}
+
+	return count;
+}
+
+// mark --save and restore network--
+
+void SoftPME_beginSaveMode(void)
+{
+	chain = 0;
+}
+
+uint16_t SoftPME_iterateNeuronsToSave(neuronData *array)
+{
+	if (chain >= SOFT_PME_MAX_NEURONS)
+	{
+		memset(array, 0, sizeof(*array));
+		return 0;
+	}
+
+	softNeuron *n = &soft_neurons[chain];
+
+	array->context = n->context;
+	array->influence = n->influence;
+	array->minInfluence = n->minInfluence;
+	array->category = (chain < committed) ? n->category : 0;
+	memcpy(array->vector, soft_vectors[chain], saveRestoreSize);
+	chain++;
+
+	return array->category;
+}
+
+void SoftPME_endSaveMode(void)
+{
+	chain = 0;
+}
+
+void SoftPME_beginRestoreMode(void)
+{
+	SoftPME_forget();
+}
+
+uint16_t SoftPME_iterateNeuronsToRestore(neuronData *array)
+{
+	if (chain >= SOFT_PME_MAX_NEURONS)
+		return 0;
+
+	softNeuron *n = &soft_neurons[chain];
+
+	n->context = array->context & (NCR_CONTEXT | NCR_NORM);
+	n->influence = array->influence;
+	n->minInfluence = array->minInfluence;
+	n->category = array->category;
+	memcpy(soft_vectors[chain], array->vector, saveRestoreSize);
+	if ((array->category & CAT_CATEGORY) && chain >= committed)
+		committed = chain + 1;
+	chain++;
+
+	return 0;
+}
+
+void SoftPME_endRestoreMode(void)
+{
+	chain = 0;
+}
+
+// neuron access by ID, 1 to the committed count
+uint16_t SoftPME_readNeuron(int32_t neuronID, neuronData *array)
+{
+	if (neuronID < firstNeuronID || neuronID > committed)
+		return 0;
+
+	softNeuron *n = &soft_neurons[neuronID - 1];
+
+	array->context = n->context;
+	array->influence = n->influence;
+	array->minInfluence = n->minInfluence;
+	array->category = n->category;
+	memcpy(array->vector, soft_vectors[neuronID - 1], saveRestoreSize);
+
+	return array->category;
+}
+
+uint16_t SoftPME_writeNeuron(int32_t neuronID, const neuronData *array)
+{
+	if (neuronID < firstNeuronID || neuronID > committed)
+		return 0;
+
+	softNeuron *n = &soft_neurons[neuronID - 1];
+
+	n->context = array->context & (NCR_CONTEXT | NCR_NORM);
+	n->influence = array->influence;
+	n->minInfluence = array->minInfluence;
+	n->category = array->category;
+	memcpy(soft_vectors[neuronID - 1], array->vector, saveRestoreSize);
+
+	return neuronID;
+}
+
+// mark -- getter and setters--
+
+uint16_t SoftPME_getCommittedCount(void)
+{
+	return committed;
+}
+
+PATTERN_MATCHING_DISTANCE_MODE SoftPME_getDistanceMode(void)
+{
+	return (GCR_DIST & gcr) ? LSUP_Distance : L1_Distance;
+}
+
+void SoftPME_setDistanceMode(PATTERN_MATCHING_DISTANCE_MODE mode)
+{
+	gcr = (mode == LSUP_Distance) ? gcr | GCR_DIST : gcr & ~GCR_DIST;
+	ncr = (ncr & ~NCR_CONTEXT) | (gcr & GCR_GLOBAL);
+}
+
+PATTERN_MATCHING_CLASSIFICATION_MODE SoftPME_getClassifierMode(void)
+{
+	return knn ? KNN_Mode : RBF_Mode;
+}
+
+void SoftPME_setClassifierMode(PATTERN_MATCHING_CLASSIFICATION_MODE mode)
+{
+	knn = (mode == KNN_Mode);
+}
+
+uint16_t SoftPME_getGlobalContext(void)
+{
+	return GCR_GLOBAL & gcr;
+}
+
+void SoftPME_setGlobalContext(uint16_t context)
+{
+	gcr = (gcr & ~GCR_GLOBAL) | (context & GCR_GLOBAL);
+	ncr = (ncr & ~NCR_CONTEXT) | (gcr & GCR_GLOBAL);
+}
+
+uint16_t SoftPME_getNeuronContext(void)
+{
+	return NCR_CONTEXT & ncr;
+}
+
+void SoftPME_setNeuronContext(uint16_t context)
+{
+	ncr = (ncr & ~NCR_CONTEXT) | (context & NCR_CONTEXT);
+}
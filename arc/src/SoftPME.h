@@ -0,0 +1,81 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef _SOFT_PME_H_
+#define _SOFT_PME_H_
+
+#include <stdint.h>
+
+#include "CuriePME.h"
+
+// Software RBF/KNN classifier with the CuriePME API. It follows the
+// accelerator (and CuriePME_emu.c) exactly: same learn and influence field
+// rules, same distance saturation and the same firing order, so a network
+// saved from one can be restored into the other and classifies the same.
+// Unlike the hardware it is not limited to 128 neurons.
+//
+// Distances are computed with SSE2 or AVX2 when the compiler targets them
+// (psadbw for L1, packed max of the saturated differences for LSUP), with a
+// portable loop everywhere else.
+
+// host builds always have the software engine
+#if !defined(__ZEPHYR__) && !defined(SOFT_PME)
+#define SOFT_PME
+#endif
+
+#ifndef SOFT_PME_MAX_NEURONS
+#ifdef __ZEPHYR__
+#define SOFT_PME_MAX_NEURONS 64    // 136 bytes of RAM each
+#else
+#define SOFT_PME_MAX_NEURONS 4096
+#endif
+#endif
+
+void SoftPME_begin(void);
+void SoftPME_forget(void);
+
+void SoftPME_configure(uint16_t global_context,
+		PATTERN_MATCHING_DISTANCE_MODE distance_mode,
+		PATTERN_MATCHING_CLASSIFICATION_MODE classification_mode,
+		uint16_t minAIF, uint16_t maxAIF);
+
+uint16_t SoftPME_learn(uint8_t *pattern_vector, int32_t vector_length, uint16_t category);
+// learn as part of a larger network: the new neuron's influence field is
+// kept below max_influence (the distance to the closest neuron of another
+// category elsewhere) and none is committed if recognized is set. Unlike
+// SoftPME_learn(), which drops the vector like the PME does once all neurons
+// are committed, returns SOFT_PME_FULL in that case.
+#define SOFT_PME_FULL 0xFFFF
+uint16_t SoftPME_learn_bounded(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t category, uint16_t max_influence, int recognized);
+uint16_t SoftPME_classify(uint8_t *pattern_vector, int32_t vector_length);
+uint16_t SoftPME_classify_next(uint16_t *distance, uint16_t *nid);
+uint16_t SoftPME_classify_all(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t *distance, uint16_t *nid);
+uint16_t SoftPME_classify_topk(uint8_t *pattern_vector, int32_t vector_length,
+		uint16_t k, classifyResult *results);
+
+// save and restore knowledge, same neuronData layout as CuriePME
+void SoftPME_beginSaveMode(void);
+uint16_t SoftPME_iterateNeuronsToSave(neuronData *data_array);
+void SoftPME_endSaveMode(void);
+
+void SoftPME_beginRestoreMode(void);
+uint16_t SoftPME_iterateNeuronsToRestore(neuronData *data_array);
+void SoftPME_endRestoreMode(void);
+
+// by ID, between 1 and the committed count
+uint16_t SoftPME_readNeuron(int32_t neuronID, neuronData *data_array);
+uint16_t SoftPME_writeNeuron(int32_t neuronID, const neuronData *data_array);
+
+//getter and setters
+uint16_t SoftPME_getCommittedCount(void);
+PATTERN_MATCHING_DISTANCE_MODE SoftPME_getDistanceMode(void);
+void SoftPME_setDistanceMode(PATTERN_MATCHING_DISTANCE_MODE mode);
+PATTERN_MATCHING_CLASSIFICATION_MODE SoftPME_getClassifierMode(void);
+void SoftPME_setClassifierMode(PATTERN_MATCHING_CLASSIFICATION_MODE mode);
+uint16_t SoftPME_getGlobalContext(void);
+void SoftPME_setGlobalContext(uint16_t context);
+uint16_t SoftPME_getNeuronContext(void);
+void SoftPME_setNeuronContext(uint16_t context);
+
+#endif // _SOFT_PME_H_
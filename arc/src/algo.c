@@ -1,108 +1,416 @@
 #ifdef __ZEPHYR__
 #include <zephyr.h>
-#include <CuriePME.h>
 #else
 #include <stdint.h>
 #endif
+#include <CuriePME.h>
+#include <algo.h>
 
 #include <stdio.h>
+#include <string.h>
 
-#define SAMPLE_BUFFER_SIZE 2048
-#define VECTOR_SIZE 128
+#include "pme_log.h"
+#include "pme_store.h"
+#include "SoftPME.h"
+#include "pme_hybrid.h"
 
-static uint8_t sample_buffer[SAMPLE_BUFFER_SIZE];
+#define VECTOR_SIZE 128
+// firing neurons read per classification; only the closest is used, the
+// rest are only logged
+#if PME_LOG_LEVEL >= PME_LOG_LEVEL_DBG
+#define PME_CLASSIFY_TOPK 4
+#else
+#define PME_CLASSIFY_TOPK 1
+#endif
 
-static int sample_i = 0;
+// sliding window defaults, in sensor samples (~6.7s window at 100Hz,
+// classified every 320ms); TYPE_PME_WINDOW changes them
+#define PME_DEFAULT_WINDOW 672
+#define PME_DEFAULT_HOP    32
 
 static uint32_t values_per_sample;
-static uint32_t samples_per_vector;
+static uint32_t samples_per_vector;  // buckets per window
+static uint32_t window_samples = PME_DEFAULT_WINDOW;
+static uint32_t hop_samples = PME_DEFAULT_HOP;
+
+// The window is kept as a ring of bucket averages, a bucket being the
+// samples averaged into one vector position. Each sample only adds into the
+// open bucket; when it closes its average is computed once (multiply by a
+// precomputed reciprocal, no divide) and reused by every window overlapping
+// it, so emitting a window is a plain copy.
+//
+// bucket average = (sum * bucket_recip) >> PME_RECIP_SHIFT, exact for all
+// sums of 8-bit samples as long as samples_per_bucket <= 127
+#define PME_RECIP_SHIFT            22
+#define PME_MAX_SAMPLES_PER_BUCKET 127
+
+static uint32_t samples_per_bucket;
+static uint32_t bucket_recip;
+static uint32_t hop_buckets;
+
+static uint32_t open_sum[VECTOR_SIZE];     // sums of the bucket being filled
+static uint32_t open_count = 0;            // samples in the open bucket
+static uint8_t bucket_ring[VECTOR_SIZE];   // closed bucket averages
+static uint32_t ring_head = 0;             // oldest closed bucket
+static uint32_t ring_count = 0;            // closed buckets in the ring
+static uint32_t hop_count = 0;             // buckets closed since last window
+
+// Segmentation instead of sliding windows: a sample is active when any value
+// moved more than segment_threshold since the previous sample (the slope test
+// of the sensor events). A segment runs from the first active sample until
+// PME_SEGMENT_QUIET samples in a row are not, and is then stretched or
+// squeezed onto the vector, so every gesture fills it whatever its duration.
+//
+// The segment is kept at 1/segment_stride of the sample rate, halving the
+// rate whenever the buffer fills up; the samples of a stored position are
+// summed in open_sum, which sliding windows do not use meanwhile.
+#define PME_SEGMENT_QUIET       25    // samples, 250ms at 100Hz
+#define PME_SEGMENT_MIN         10    // shorter segments are noise
+#define PME_SEGMENT_MAX         1024  // samples, longer motion is cut
+#define PME_SEGMENT_BUFFER      1536  // bytes
+
+static uint32_t segment_threshold = 0;     // 0: sliding windows
+static uint8_t segment[PME_SEGMENT_BUFFER];
+static uint8_t last_sample[VECTOR_SIZE];
+static uint32_t segment_stored = 0;        // positions in segment
+static uint32_t segment_stride = 1;        // samples per position, power of 2
+static uint32_t segment_samples = 0;       // samples since the onset, 0: idle
+static uint32_t segment_active = 0;        // samples up to the last active one
+
+void pme_set_window(uint32_t window, uint32_t hop)
+{
+	window_samples = window;
+	hop_samples = hop;
+
+	samples_per_bucket = window / samples_per_vector;
+	if (samples_per_bucket == 0)
+		samples_per_bucket = 1;
+	if (samples_per_bucket > PME_MAX_SAMPLES_PER_BUCKET)
+		samples_per_bucket = PME_MAX_SAMPLES_PER_BUCKET;
+
+	bucket_recip = ((1UL << PME_RECIP_SHIFT) + samples_per_bucket - 1) /
+		samples_per_bucket;
+
+	hop_buckets = hop / samples_per_bucket;
+	if (hop_buckets == 0)
+		hop_buckets = 1;
+	if (hop_buckets > samples_per_vector)
+		hop_buckets = samples_per_vector;
+
+	for (int i = 0; i < VECTOR_SIZE; i++)
+		open_sum[i] = 0;
+	open_count = 0;
+	ring_head = 0;
+	ring_count = 0;
+	hop_count = 0;
+	segment_samples = 0;
+	memset(last_sample, 0, sizeof(last_sample));
+
+	PME_DBG("%s: buckets=%lu samples_per_bucket=%lu hop_buckets=%lu\n",
+		__FUNCTION__, (unsigned long)samples_per_vector,
+		(unsigned long)samples_per_bucket, (unsigned long)hop_buckets);
+}
 
-static uint8_t average(uint8_t *input, uint32_t pos, uint32_t step, uint32_t count)
+void pme_set_sample_size(uint32_t values)
 {
-	uint32_t ret = 0;
+	if (values == 0 || values > VECTOR_SIZE)
+		values = 3;
 
-	//printf("%s: pos=%3d, step=%3d, count=%3d", __FUNCTION__, pos, step, count);
+	// the window keeps its duration, the buckets get fewer positions
+	values_per_sample  = values;
+	samples_per_vector = VECTOR_SIZE / values_per_sample;
+	pme_set_window(window_samples, hop_samples);
+}
 
-	for (int i = 0; i < count; i++) {
-		ret += input[pos + (step * i)];
-	}
-	ret /= count;
-	//printf(", ret=%3d\n", ret);
+void pme_set_segmentation(uint32_t threshold)
+{
+	segment_threshold = threshold;
+	pme_set_window(window_samples, hop_samples);
+	PME_DBG("%s: threshold=%lu\n", __FUNCTION__, (unsigned long)threshold);
+}
+
+// write the current window into vector, oldest bucket first
+static void emit_window(uint8_t *vector)
+{
+	uint32_t split = ring_head * values_per_sample;
+	uint32_t size = samples_per_vector * values_per_sample;
 
-	return (uint8_t)ret;
+	memcpy(vector, &bucket_ring[split], size - split);
+	memcpy(vector + size - split, bucket_ring, split);
 }
 
-static void undersample(uint8_t *input, uint32_t samples, uint8_t *output)
+// integer square root, v < 2^16
+static uint32_t isqrt16(uint32_t v)
 {
-	uint32_t ii = 0; // input position
-	uint32_t oi = 0; // outout position
-	uint32_t count = samples / samples_per_vector;
+	uint32_t root = 0;
+
+	for (uint32_t bit = 1 << 14; bit; bit >>= 2) {
+		if (v >= root + bit) {
+			v -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+	}
+	return root;
+}
+
+void pme_quant_init(pme_quant_t *quant, int32_t min, int32_t max, uint8_t compand)
+{
+	if (max <= min)
+		max = min + 1;
 
-	printf("%s: samples=%lu samples_per_vector=%ld count=%ld\n", 
-		__FUNCTION__, samples, samples_per_vector, count);
+	quant->min = min;
+	quant->max = max;
+	quant->scale = (255UL << 16) / (uint32_t)(max - min);
+	quant->compand = compand;
+}
 
-	for (int i = 0; i < samples_per_vector; i++) {
-		for (int j = 0; j < values_per_sample; j++) {
-			output[oi + j] = average(input, ii + j, values_per_sample, count);
+uint8_t pme_quantize(const pme_quant_t *quant, int32_t value)
+{
+	uint32_t code;
+
+	if (value <= quant->min)
+		code = 0;
+	else if (value >= quant->max)
+		code = 255;
+	else
+		code = ((uint32_t)(value - quant->min) * quant->scale) >> 16;
+
+	if (quant->compand) {
+		// code = 128 +/- sqrt(|code - 128| * 128)
+		if (code >= 128) {
+			code = 128 + isqrt16((code - 128) * 128);
+			if (code > 255)
+				code = 255;
+		} else {
+			code = 128 - isqrt16((128 - code) * 128);
 		}
-		ii += (count * 3);
-		oi += 3;
 	}
+
+	return (uint8_t)code;
 }
 
 void pme_init(void)
 {
-	values_per_sample  = 3; // X,Y,Z
-	samples_per_vector = VECTOR_SIZE / values_per_sample;
-#ifdef __ZEPHYR__
-	printf("%s\n", __FUNCTION__);
+	window_samples = PME_DEFAULT_WINDOW;
+	hop_samples = PME_DEFAULT_HOP;
+	segment_threshold = 0;
+	pme_set_sample_size(3); // X,Y,Z
+	PME_INFO("%s\n", __FUNCTION__);
+#ifdef SOFT_PME
+	pme_hybrid_forget();
+#endif
 	CuriePME_begin();
 	CuriePME_configure(1, L1_Distance, RBF_Mode, 0, 32);
-#endif
+
+	// pick up the network learned before the last reset, if any
+	int32_t restored = pme_store_restore();
+	if (restored >= 0)
+		PME_INFO("%s: restored %ld neurons\n", __FUNCTION__, (long)restored);
+}
+
+// halve the rate of the stored segment
+static void segment_decimate(void)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < segment_stored / 2; i++) {
+		for (j = 0; j < values_per_sample; j++) {
+			segment[i * values_per_sample + j] =
+				(segment[2 * i * values_per_sample + j] +
+				 segment[(2 * i + 1) * values_per_sample + j] + 1) >> 1;
+		}
+	}
+	if (segment_stored & 1) {
+		memcpy(&segment[i * values_per_sample],
+			&segment[(segment_stored - 1) * values_per_sample],
+			values_per_sample);
+		i++;
+	}
+	segment_stored = i;
+	segment_stride <<= 1;
+}
+
+// resample the segment up to its last active sample onto the vector
+static void segment_emit(uint8_t *vector)
+{
+	uint32_t count = (segment_active + segment_stride - 1) / segment_stride;
+
+	if (count > segment_stored)
+		count = segment_stored;
+
+	for (uint32_t b = 0; b < samples_per_vector; b++) {
+		uint32_t first = b * count / samples_per_vector;
+		uint32_t end = (b + 1) * count / samples_per_vector;
+		if (end <= first)
+			end = first + 1;
+
+		for (uint32_t j = 0; j < values_per_sample; j++) {
+			uint32_t sum = 0;
+			for (uint32_t i = first; i < end; i++)
+				sum += segment[i * values_per_sample + j];
+			vector[b * values_per_sample + j] = sum / (end - first);
+		}
+	}
 }
 
+// returns 1 when a segment has been written to vector
+static uint32_t process_segment(uint8_t *data, uint8_t *vector)
+{
+	uint32_t active = 0;
+	uint32_t j;
+
+	for (j = 0; j < values_per_sample; j++) {
+		int32_t delta = (int32_t)data[j] - last_sample[j];
+		if (delta > (int32_t)segment_threshold ||
+		    delta < -(int32_t)segment_threshold)
+			active = 1;
+		last_sample[j] = data[j];
+	}
+
+	if (segment_samples == 0) {
+		if (!active)
+			return 0;
+		// onset
+		segment_stored = 0;
+		segment_stride = 1;
+		open_count = 0;
+		for (j = 0; j < values_per_sample; j++)
+			open_sum[j] = 0;
+	}
+
+	segment_samples++;
+	if (active)
+		segment_active = segment_samples;
+
+	for (j = 0; j < values_per_sample; j++)
+		open_sum[j] += data[j];
+
+	// a full buffer halves the rate, the open position then takes twice
+	// the samples like the others
+	if (++open_count == segment_stride &&
+	    (segment_stored + 1) * values_per_sample > PME_SEGMENT_BUFFER)
+		segment_decimate();
+
+	if (open_count == segment_stride) {
+		uint32_t shift = __builtin_ctz(segment_stride);
+
+		for (j = 0; j < values_per_sample; j++) {
+			segment[segment_stored * values_per_sample + j] =
+				open_sum[j] >> shift;
+			open_sum[j] = 0;
+		}
+		segment_stored++;
+		open_count = 0;
+	}
+
+	// offset: quiet long enough, or motion that does not end
+	if (segment_samples - segment_active < PME_SEGMENT_QUIET &&
+	    segment_samples < PME_SEGMENT_MAX)
+		return 0;
+
+	segment_samples = 0;
+	if (segment_active < PME_SEGMENT_MIN || segment_stored == 0)
+		return 0;
+
+	PME_DBG("%s: %lu samples\n", __FUNCTION__, (unsigned long)segment_active);
+	segment_emit(vector);
+	return 1;
+}
+
+// returns 1 when a new window or segment has been written to vector
 uint32_t pme_process_sample(uint8_t *data, uint32_t data_len, uint8_t *vector)
 {
-	sample_buffer[sample_i] = data[0];
-	sample_buffer[sample_i + 1] = data[1];
-	sample_buffer[sample_i + 2] = data[2];
+	if (data_len < values_per_sample)
+		return 0;
+	if (segment_threshold)
+		return process_segment(data, vector);
 
-	sample_i += 3;
+	for (uint32_t j = 0; j < values_per_sample; j++)
+		open_sum[j] += data[j];
 
-	if (sample_i + 3 > SAMPLE_BUFFER_SIZE) {
-		undersample(sample_buffer, sample_i/3, vector);
-		sample_i = 0;
-		return 1;
+	if (++open_count < samples_per_bucket)
+		return 0;
+
+	// close the bucket, overwriting the oldest one once the ring is full
+	uint32_t slot = ring_head + ring_count;
+	if (ring_count == samples_per_vector) {
+		slot = ring_head;
+		if (++ring_head == samples_per_vector)
+			ring_head = 0;
+	} else {
+		if (slot >= samples_per_vector)
+			slot -= samples_per_vector;
+		ring_count++;
 	}
-	return 0;
+
+	for (uint32_t j = 0; j < values_per_sample; j++) {
+		bucket_ring[slot * values_per_sample + j] =
+			(uint8_t)((open_sum[j] * bucket_recip) >> PME_RECIP_SHIFT);
+		open_sum[j] = 0;
+	}
+	open_count = 0;
+	hop_count++;
+
+	if (ring_count < samples_per_vector || hop_count < hop_buckets)
+		return 0;
+
+	hop_count = 0;
+	emit_window(vector);
+	return 1;
 }
 
-uint16_t pme_learn(uint8_t *vector, uint32_t len, uint16_t category) 
+int32_t pme_learn(uint8_t *vector, uint32_t len, uint16_t category) 
 {
-	printf("%s: category=%d is %lu byte vector\n", __FUNCTION__, category, len);
-	for (int i = 0; i < len; i++)
-		printf("%d ", vector[i]);
-	printf("\n");
-	return CuriePME_learn(vector, len, category);
+	int32_t count;
+
+	PME_DBG("%s: category=%d is %lu byte vector\n", __FUNCTION__, category,
+		(unsigned long)len);
+	PME_DBG_VECTOR(vector, len);
+#ifdef SOFT_PME
+	// beyond 128 neurons learning continues in the software pool
+	count = pme_hybrid_learn(vector, len, category);
+#else
+	count = CuriePME_learn(vector, len, category);
+#endif
+
+	// learning can also shrink existing influence fields, always persist
+	pme_store_touch();
+	return count;
 }
 
 uint16_t pme_classify(uint8_t *vector, uint32_t len) 
 {
-	printf("%s: %lu byte vector\n", __FUNCTION__, len);
-	for (int i = 0; i < len; i++)
-		printf("%d ", vector[i]);
-	printf("\n");
+	return pme_classify_best(vector, len, NULL);
+}
 
-	CuriePME_bcast_vector(vector, len);
+uint16_t pme_classify_best(uint8_t *vector, uint32_t len, classifyResult *best)
+{
+	PME_DBG("%s: %lu byte vector\n", __FUNCTION__, (unsigned long)len);
+	PME_DBG_VECTOR(vector, len);
 
-	uint16_t dist=0, id=0, cat, bestCat;
+	classifyResult hits[PME_CLASSIFY_TOPK];
+#ifdef SOFT_PME
+	uint16_t count = pme_hybrid_classify_topk(vector, len, PME_CLASSIFY_TOPK, hits);
+#else
+	uint16_t count = CuriePME_classify_topk(vector, len, PME_CLASSIFY_TOPK, hits);
+#endif
 
-	bestCat = cat = CuriePME_classify_next(&dist, &id);
-	while (cat != 0x7FFF) {
-		printf("pme_classify: cat=%d dist=%d id=%d\n", cat, dist, id);
-		cat = CuriePME_classify_next(&dist, &id);
+	for (int i = 0; i < count; i++)
+		PME_DBG("pme_classify: cat=%d dist=%d id=%d\n",
+			hits[i].category, hits[i].distance, hits[i].nid);
+
+	if (best) {
+		if (count) {
+			*best = hits[0];
+		} else {
+			best->category = noMatch;
+			best->distance = 0xFFFF;
+			best->nid = 0;
+		}
 	}
-	return bestCat;
+	return count ? hits[0].category : noMatch;
 }
 
 void pme_read(void)
@@ -127,46 +435,212 @@ void pme_read(void)
 	}
 
 	CuriePME_endSaveMode();
+
+#ifdef PME_TRACE
+	pme_trace_dump();
+#endif
+}
+
+// drop the network and its stored copy
+void pme_forget(void)
+{
+	PME_INFO("%s\n", __FUNCTION__);
+#ifdef SOFT_PME
+	pme_hybrid_forget();
+#else
+	CuriePME_forget();
+#endif
+	pme_store_erase();
+}
+
+// compare the per-vector broadcast cost of the old byte-indexed loop
+// against the CuriePME broadcast path
+void pme_bench_bcast(uint32_t rounds)
+{
+	static uint8_t bench_vector[VECTOR_SIZE];
+	uint32_t start, legacy, burst;
+
+	if (rounds == 0)
+		return;
+
+	for (int i = 0; i < VECTOR_SIZE; i++)
+		bench_vector[i] = i;
+
+	start = pme_cycles();
+	for (uint32_t r = 0; r < rounds; r++) {
+		uint8_t index;
+		for (index = 0; index < (VECTOR_SIZE - 1); index++)
+			regWrite16(COMP, bench_vector[index]);
+		regWrite16(LCOMP, bench_vector[VECTOR_SIZE - 1]);
+	}
+	legacy = pme_cycles() - start;
+
+	start = pme_cycles();
+	for (uint32_t r = 0; r < rounds; r++)
+		CuriePME_bcast_vector(bench_vector, VECTOR_SIZE);
+	burst = pme_cycles() - start;
+
+	printf("%s: %lu vectors, legacy=%lu burst=%lu cycles/vector\n",
+		__FUNCTION__, (unsigned long)rounds,
+		(unsigned long)(legacy / rounds), (unsigned long)(burst / rounds));
+}
+
+#ifdef SOFT_PME
+#define PME_CHECK_TOPK 4  // firing neurons compared per vector
+
+// load the network into the software engine and classify the same random
+// vectors on both, comparing the closest firing neurons in order; any
+// difference points at the hardware (or the model)
+void pme_check_soft(uint32_t rounds)
+{
+	static uint8_t check_vector[VECTOR_SIZE];
+	neuronData neuron;
+	classifyResult hw_hits[PME_CHECK_TOPK], sw_hits[PME_CHECK_TOPK];
+	uint32_t mismatches = 0, fired = 0, start, cycles;
+	uint32_t seed = 1;
+
+	uint16_t neurons = CuriePME_getCommittedCount();
+	if (neurons > SOFT_PME_MAX_NEURONS || rounds == 0) {
+		PME_ERR("%s: %d neurons do not fit\n", __FUNCTION__, neurons);
+		return;
+	}
+	// the engine doubles as the pme_hybrid pool
+	if (SoftPME_getCommittedCount()) {
+		PME_ERR("%s: software pool in use\n", __FUNCTION__);
+		return;
+	}
+
+	SoftPME_beginRestoreMode();
+	CuriePME_beginSaveMode();
+	for (int i = 0; i < neurons; i++) {
+		CuriePME_iterateNeuronsToSave(&neuron);
+		SoftPME_iterateNeuronsToRestore(&neuron);
+	}
+	CuriePME_endSaveMode();
+	SoftPME_endRestoreMode();
+
+	SoftPME_configure(CuriePME_getGlobalContext(), CuriePME_getDistanceMode(),
+		CuriePME_getClassifierMode(), getMINIF(), getMAXIF());
+	SoftPME_setClassifierMode(CuriePME_getClassifierMode());
+
+	cycles = 0;
+	for (uint32_t r = 0; r < rounds; r++) {
+		for (int i = 0; i < VECTOR_SIZE; i++) {
+			seed = seed * 1103515245 + 12345;
+			check_vector[i] = seed >> 24;
+		}
+
+		uint16_t hw = CuriePME_classify_topk(check_vector, VECTOR_SIZE,
+			PME_CHECK_TOPK, hw_hits);
+		start = pme_cycles();
+		uint16_t sw = SoftPME_classify_topk(check_vector, VECTOR_SIZE,
+			PME_CHECK_TOPK, sw_hits);
+		cycles += pme_cycles() - start;
+
+		if (hw)
+			fired++;
+		if (hw != sw) {
+			mismatches++;
+			continue;
+		}
+		for (int i = 0; i < hw; i++) {
+			if (hw_hits[i].category != sw_hits[i].category ||
+				hw_hits[i].distance != sw_hits[i].distance ||
+				hw_hits[i].nid != sw_hits[i].nid) {
+				mismatches++;
+				break;
+			}
+		}
+	}
+
+	SoftPME_forget();
+
+	printf("%s: %lu vectors (%lu fired), %lu mismatches, software %lu "
+		"cycles/vector\n", __FUNCTION__, (unsigned long)rounds,
+		(unsigned long)fired, (unsigned long)mismatches,
+		(unsigned long)(cycles / rounds));
 }
+#endif
 
 #ifndef __ZEPHYR__
-void fill(uint16_t *data, uint16_t v0, uint16_t v1, uint16_t v2)
+// host build, runs on the PME emulator (see CuriePME_emu.c)
+void fill(uint8_t *data, uint8_t v0, uint8_t v1, uint8_t v2)
 {
 	data[0] = v0; data[1] = v1; data[2] = v2;
 }
 
+// fill the network with random vectors, then check the software engine
+// against it in every classifier and distance mode
+static void check_soft_modes(void)
+{
+	static const PATTERN_MATCHING_DISTANCE_MODE distances[] = {
+		L1_Distance, LSUP_Distance
+	};
+	// wide enough for random vectors to fire in RBF mode
+	static const uint16_t max_influence[] = { 0x3FFF, 0xFF };
+	uint8_t random_vector[VECTOR_SIZE];
+
+	for (int d = 0; d < 2; d++) {
+		uint32_t seed = 7;
+
+		pme_forget();
+		CuriePME_configure(1, distances[d], RBF_Mode, 2, max_influence[d]);
+		for (int n = 0; n < 300; n++) {
+			for (int i = 0; i < VECTOR_SIZE; i++) {
+				seed = seed * 1103515245 + 12345;
+				random_vector[i] = seed >> 24;
+			}
+			// the PME alone, the software engine is checked against it
+			CuriePME_learn(random_vector, VECTOR_SIZE, 1 + n % 10);
+		}
+		printf("%s: %d neurons\n", distances[d] == L1_Distance ? "L1" : "LSUP",
+			CuriePME_getCommittedCount());
+
+		CuriePME_setClassifierMode(RBF_Mode);
+		pme_check_soft(10000);
+		CuriePME_setClassifierMode(KNN_Mode);
+		pme_check_soft(10000);
+	}
+	pme_forget();
+}
+
 int main()
 {
-	uint16_t test[3];
+	uint8_t test[3];
+	uint8_t vector[VECTOR_SIZE] = {0};
 	int i;
 
 	pme_init();
 
 	FILE *raw_file = fopen("raw.txt", "w");
-	FILE *scale_file = fopen("scale.txt", "w");
 	FILE *vector_file = fopen("vector.txt", "w");
 
-	if (!raw_file || !scale_file || !vector_file) {
+	if (!raw_file || !vector_file) {
 		printf("Can not open file\n");
 		return 0;
 	}
 
-	for (i = 0; i < SAMPLE_BUFFER_SIZE; i++) {
+	for (i = 0; i < PME_DEFAULT_WINDOW * 4; i++) {
 		fill(test, i*100, i*200, i*300);
 		fprintf(raw_file, "%5d %5d %5d %5d\n", i, test[0], test[1], test[2]);
-		if (pme_process_sample(test, sizeof(test))) {
+		if (pme_process_sample(test, sizeof(test), vector)) {
 			break;
 		}
 	}
 
-	for (i = 0; i < SAMPLE_BUFFER_SIZE; i += 3)
-		fprintf(scale_file, "%5d,%5d,%5d,%5d\n", i/3, sample_buffer[i], sample_buffer[i+1], sample_buffer[i+2]);
-	
-	for (i = 0; i < VECTOR_SIZE; i += 3)
+	for (i = 0; i + 2 < VECTOR_SIZE; i += 3)
 		fprintf(vector_file, "%5d,%5d,%5d,%5d\n", i/3, vector[i], vector[i+1], vector[i+2]);
 
 	fclose(raw_file);
-	fclose(scale_file);
 	fclose(vector_file);
+
+	pme_learn(vector, sizeof(vector), 1);
+	printf("neurons: %d\n", CuriePME_getCommittedCount());
+	printf("category: %d\n", pme_classify(vector, sizeof(vector)));
+	pme_read();
+	pme_bench_bcast(100000);
+	check_soft_modes();
+
+	return 0;
 }
-#endif
\ No newline at end of file
+#endif
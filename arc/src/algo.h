@@ -1,8 +1,44 @@
+#ifndef __algo_h__
+#define __algo_h__
+
+#include <CuriePME.h>
+
+// Integer sensor-to-feature quantizer: values (in milli-units) between min
+// and max map linearly onto 0-255 and saturate outside. With compand set,
+// small deviations from the middle of the range get more codes (square-root
+// companding) at the expense of the extremes.
+typedef struct pme_quant {
+	int32_t min;
+	int32_t max;
+	uint32_t scale;    // Q16, 255 / (max - min)
+	uint8_t compand;
+} pme_quant_t;
+
+void pme_quant_init(pme_quant_t *quant, int32_t min, int32_t max, uint8_t compand);
+uint8_t pme_quantize(const pme_quant_t *quant, int32_t value);
+
 void pme_init(void);
+// sliding window length and the samples between two windows, rounded to
+// whole buckets (window / positions per vector samples); restarts the window
+void pme_set_window(uint32_t window, uint32_t hop);
+// values per sample, e.g. 6 for interleaved accelerometer and gyroscope
+// X,Y,Z; restarts the window
+void pme_set_sample_size(uint32_t values);
+// with a threshold, vectors are built from gestures (runs of samples moving
+// more than threshold codes between samples) instead of sliding windows;
+// 0 goes back to sliding windows
+void pme_set_segmentation(uint32_t threshold);
 uint32_t pme_process_sample(uint8_t *data, uint32_t len, uint8_t *vector);
-uint16_t pme_learn(uint8_t *vector, uint32_t len, uint16_t category); 
+// returns the committed count, -1 if the vector was not learned because the
+// software pool is full (pme_hybrid_learn()); the network is saved later,
+// see pme_store_flush()
+int32_t pme_learn(uint8_t *vector, uint32_t len, uint16_t category); 
 uint16_t pme_classify(uint8_t *vector, uint32_t len);
-uint16_t CuriePME_classify_all(uint8_t *pattern_vector, int32_t vector_length,
-	uint16_t *distance, uint16_t *nid);
+// also reports the closest firing neuron, distance 0xFFFF if none fired
+uint16_t pme_classify_best(uint8_t *vector, uint32_t len, classifyResult *best);
 void pme_read(void);
+void pme_forget(void);
+void pme_bench_bcast(uint32_t rounds);
+void pme_check_soft(uint32_t rounds);  // needs SOFT_PME
 
+#endif  // __algo_h__
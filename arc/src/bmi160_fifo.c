@@ -0,0 +1,197 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#include <zephyr.h>
+#include <gpio.h>
+#include <misc/util.h>
+#include <sensor/bmi160/bmi160.h>
+
+#include "bmi160_fifo.h"
+
+#define FIFO_REG_LENGTH0    0x22
+#define FIFO_REG_DATA       0x24
+#define FIFO_REG_ACC_RANGE  0x41
+#define FIFO_REG_GYR_RANGE  0x43
+#define FIFO_REG_CONFIG0    0x46  // watermark, in 4 byte units
+#define FIFO_REG_CONFIG1    0x47
+#define FIFO_REG_INT_EN1    0x51
+#define FIFO_REG_INT_MAP1   0x56
+#define FIFO_REG_CMD        0x7E
+
+#define FIFO_GYR_EN         0x80
+#define FIFO_ACC_EN         0x40
+#define FIFO_INT_FWM        0x40  // INT_EN1 and INT_MAP1 (to INT1)
+#define FIFO_CMD_FLUSH      0xB0
+
+// bytes per SPI read, whole frames of either size; the driver takes an
+// 8 bit length that includes the dummy byte
+#define FIFO_BURST          252
+
+static struct device *gpio = NULL;
+static struct gpio_callback gpio_cb;
+static bmi160_fifo_handler_t fifo_handler = NULL;
+static uint8_t frame_size = 0;  // 0 while stopped
+static bool has_accel = false;
+static bool has_gyro = false;
+static int32_t accel_scale;     // full scale in milli units / 4
+static int32_t gyro_scale;
+static uint8_t burst[1 + FIFO_BURST];
+
+static void fifo_gpio_callback(struct device *port, struct gpio_callback *cb,
+                               uint32_t pins)
+{
+    // the driver's own callback runs too and ignores the watermark
+    if (frame_size && fifo_handler) {
+        fifo_handler();
+    }
+}
+
+// full scale of the configured ranges, so frames convert without a divide
+static int read_scales(struct device *dev)
+{
+    uint8_t range;
+
+    if (bmi160_byte_read(dev, FIFO_REG_ACC_RANGE, &range) < 0) {
+        return -1;
+    }
+    switch (range & 0x0F) {
+    case 0x05: accel_scale = 4 * 9807; break;
+    case 0x08: accel_scale = 8 * 9807; break;
+    case 0x0C: accel_scale = 16 * 9807; break;
+    default:   accel_scale = 2 * 9807; break;
+    }
+
+    if (bmi160_byte_read(dev, FIFO_REG_GYR_RANGE, &range) < 0) {
+        return -1;
+    }
+    gyro_scale = (2000 >> (range & 0x07)) * 17453 / 1000;  // deg/s to milli rad/s
+
+    accel_scale >>= 2;
+    gyro_scale >>= 2;
+    return 0;
+}
+
+static inline int32_t frame_value(const uint8_t *p, int32_t scale)
+{
+    int16_t raw = (int16_t)(p[0] | (p[1] << 8));
+    return ((int32_t)raw * scale) >> 13;  // raw / 2^15 * full scale
+}
+
+int bmi160_fifo_start(struct device *dev, bool accel, bool gyro,
+                      uint32_t watermark, bmi160_fifo_handler_t handler)
+{
+    if (!accel && !gyro) {
+        return -1;
+    }
+    if (frame_size) {
+        bmi160_fifo_stop(dev);
+    }
+
+    gpio = device_get_binding(CONFIG_BMI160_GPIO_DEV_NAME);
+    if (!gpio || read_scales(dev) < 0) {
+        return -1;
+    }
+
+    has_accel = accel;
+    has_gyro = gyro;
+    uint8_t size = (accel ? 6 : 0) + (gyro ? 6 : 0);
+
+    // the watermark is set in 4 byte units, keep a frame of headroom
+    uint32_t max = (BMI160_FIFO_BYTES - size) / size;
+    if (watermark == 0) {
+        watermark = 1;
+    } else if (watermark > max) {
+        watermark = max;
+    }
+
+    if (bmi160_byte_write(dev, FIFO_REG_CMD, FIFO_CMD_FLUSH) < 0 ||
+        bmi160_byte_write(dev, FIFO_REG_CONFIG0,
+                          (watermark * size + 3) / 4) < 0 ||
+        bmi160_byte_write(dev, FIFO_REG_CONFIG1,
+                          (accel ? FIFO_ACC_EN : 0) |
+                          (gyro ? FIFO_GYR_EN : 0)) < 0 ||
+        bmi160_reg_update(dev, FIFO_REG_INT_MAP1, FIFO_INT_FWM,
+                          FIFO_INT_FWM) < 0 ||
+        bmi160_reg_update(dev, FIFO_REG_INT_EN1, FIFO_INT_FWM,
+                          FIFO_INT_FWM) < 0) {
+        return -1;
+    }
+
+    fifo_handler = handler;
+    gpio_init_callback(&gpio_cb, fifo_gpio_callback,
+                       BIT(CONFIG_BMI160_GPIO_PIN_NUM));
+    gpio_add_callback(gpio, &gpio_cb);
+    frame_size = size;
+    return 0;
+}
+
+int bmi160_fifo_stop(struct device *dev)
+{
+    if (!frame_size) {
+        return 0;
+    }
+
+    frame_size = 0;
+    gpio_remove_callback(gpio, &gpio_cb);
+
+    if (bmi160_reg_update(dev, FIFO_REG_INT_EN1, FIFO_INT_FWM, 0) < 0 ||
+        bmi160_reg_update(dev, FIFO_REG_INT_MAP1, FIFO_INT_FWM, 0) < 0 ||
+        bmi160_byte_write(dev, FIFO_REG_CONFIG1, 0) < 0 ||
+        bmi160_byte_write(dev, FIFO_REG_CMD, FIFO_CMD_FLUSH) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+bool bmi160_fifo_running(void)
+{
+    return frame_size != 0;
+}
+
+int bmi160_fifo_read(struct device *dev, bmi160_fifo_frame_t *frames, int max)
+{
+    uint8_t length[3];  // dummy byte, FIFO_LENGTH_0, FIFO_LENGTH_1
+
+    if (!frame_size) {
+        return -1;
+    }
+    if (bmi160_read(dev, FIFO_REG_LENGTH0, length, sizeof(length)) < 0) {
+        return -1;
+    }
+
+    uint32_t bytes = (length[1] | (length[2] << 8)) & 0x07FF;
+    int count = bytes / frame_size;
+    if (count > max) {
+        count = max;
+    }
+
+    // headerless frames: gyroscope X,Y,Z then accelerometer X,Y,Z
+    for (int done = 0; done < count; ) {
+        int n = count - done;
+        if (n > FIFO_BURST / frame_size) {
+            n = FIFO_BURST / frame_size;
+        }
+        if (bmi160_read(dev, FIFO_REG_DATA, burst, 1 + n * frame_size) < 0) {
+            return -1;
+        }
+
+        const uint8_t *p = &burst[1];
+        for (int i = 0; i < n; i++, done++) {
+            bmi160_fifo_frame_t *frame = &frames[done];
+            for (int axis = 0; axis < 3; axis++) {
+                frame->gyro[axis] = 0;
+                frame->accel[axis] = 0;
+            }
+            if (has_gyro) {
+                for (int axis = 0; axis < 3; axis++, p += 2) {
+                    frame->gyro[axis] = frame_value(p, gyro_scale);
+                }
+            }
+            if (has_accel) {
+                for (int axis = 0; axis < 3; axis++, p += 2) {
+                    frame->accel[axis] = frame_value(p, accel_scale);
+                }
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef __bmi160_fifo_h__
+#define __bmi160_fifo_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <device.h>
+
+// Batched BMI160 acquisition: the sensor queues samples in its 1KB FIFO and
+// raises INT1 once the watermark is reached, then all queued frames are
+// pulled in a few SPI bursts instead of one transaction per sample.
+//
+// This goes around the sensor API (it has no FIFO support) through the
+// driver's register access, so it must not run while the data ready
+// triggers are enabled.
+
+#define BMI160_FIFO_BYTES  1024
+#define BMI160_FIFO_FRAMES (BMI160_FIFO_BYTES / 12)  // with both sensors
+
+// one headerless frame, the sensors not enabled are zero
+typedef struct bmi160_fifo_frame {
+    int32_t accel[3];  // milli m/s^2
+    int32_t gyro[3];   // milli rad/s
+} bmi160_fifo_frame_t;
+
+typedef void (*bmi160_fifo_handler_t)(void);
+
+// start queuing the enabled sensors at their configured rate, handler is
+// called from interrupt context once watermark frames are queued
+int bmi160_fifo_start(struct device *dev, bool accel, bool gyro,
+                      uint32_t watermark, bmi160_fifo_handler_t handler);
+int bmi160_fifo_stop(struct device *dev);
+bool bmi160_fifo_running(void);
+
+// read up to max queued frames, returns how many or -1 on error
+int bmi160_fifo_read(struct device *dev, bmi160_fifo_frame_t *frames, int max);
+
+#endif  // __bmi160_fifo_h__
@@ -22,14 +22,22 @@
 #include <sensor/bmi160/bmi160.h>
 #include <algo.h>
 #include <CuriePME.h>
+#include "pme_log.h"
+#include "pme_store.h"
+#include "pme_model.h"
+#include "bmi160_fifo.h"
+#ifdef SOFT_PME
+#include "pme_hybrid.h"
+#endif
 #endif
 
 #include "zjs_common.h"
 #include "zjs_ipm.h"
 
-#define QUEUE_SIZE            10  // max incoming message can handle
-#define SLEEP_TICKS            1  // 10ms sleep time in cpu ticks
-#define AIO_UPDATE_INTERVAL  200  // 2sec interval in between notifications
+#ifndef QUEUE_SIZE
+#define QUEUE_SIZE            16  // max incoming message can handle
+#endif
+#define AIO_UPDATE_INTERVAL  200  // ticks in between notifications
 
 #define MAX_I2C_BUS 2
 
@@ -41,9 +49,48 @@
 #define BMI160_NAME BMI160_DEVICE_NAME
 #endif
 
-static struct k_sem arc_sem;
-static struct zjs_ipm_message msg_queue[QUEUE_SIZE];
-static struct zjs_ipm_message *end_of_queue_ptr = msg_queue + QUEUE_SIZE;
+#if (QUEUE_SIZE & (QUEUE_SIZE - 1)) || QUEUE_SIZE < ZJS_IPM_RING_RECORDS
+#error "QUEUE_SIZE must be a power of two, at least ZJS_IPM_RING_RECORDS"
+#endif
+
+// Single producer (the IPM callback) / single consumer (the main loop) ring,
+// each side only writes its own index so no lock is needed. Received
+// messages stay in their IPM ring record, only pointers are queued.
+static struct zjs_ipm_message *msg_queue[QUEUE_SIZE];
+static volatile uint32_t queue_head = 0;   // written by the IPM callback
+static volatile uint32_t queue_tail = 0;   // written by the main loop
+static uint32_t queue_dropped = 0;
+
+#define queue_barrier() __asm__ __volatile__("" ::: "memory")
+
+// The main loop sleeps on work_sem until there is something to do. The IPM
+// callback gives it for every queued message, the poll timers for periodic
+// AIO and sensor updates, which they flag in work_pending.
+static struct k_sem work_sem;
+static volatile uint32_t work_pending = 0;
+
+#define WORK_AIO_UPDATE       0x01
+#define WORK_SENSOR_POLL      0x02
+#define WORK_SENSOR_FIFO      0x04
+#define WORK_PME_READINGS     0x08
+#define WORK_PME_SAVE         0x10
+
+static void signal_work(uint32_t work)
+{
+    unsigned int key = irq_lock();
+    work_pending |= work;
+    irq_unlock(key);
+    k_sem_give(&work_sem);
+}
+
+static uint32_t take_work(void)
+{
+    unsigned int key = irq_lock();
+    uint32_t work = work_pending;
+    work_pending = 0;
+    irq_unlock(key);
+    return work;
+}
 
 #if defined(BUILD_MODULE_AIO) || defined(BUILD_MODULE_SENSOR_LIGHT)
 static struct device *adc_dev = NULL;
@@ -74,9 +121,11 @@ static struct device *bmi160 = NULL;
 static bool accel_trigger = false;      // trigger mode
 static bool gyro_trigger = false;       // trigger mode
 static bool temp_poll = false;          // polling mode
-static double accel_last_value[3];
-static double gyro_last_value[3];
-static double temp_last_value;
+// last readings sent, in milli-units
+static int32_t accel_last_value[3];
+static int32_t gyro_last_value[3];
+static int32_t temp_last_value;
+#define ACCEL_SLOPE_MILLI 981           // 0.1G in mm/s^2
 #endif
 
 #ifdef BUILD_MODULE_PME
@@ -85,11 +134,42 @@ static double temp_last_value;
 #define PME_MODE_CLASSIFY 2
 static uint32_t pme_mode = PME_MODE_NO_OP;
 
-#define PME_DATA_SOURCE_ACCEL 0x01
-#define PME_DATA_SOURCE_GYRO  0x02
-static uint32_t pme_data_source = 0;
+static uint32_t pme_data_source = PME_DATA_SOURCE_ACCEL;
 static uint16_t pme_category = 0;
+static uint16_t pme_model = PME_MODEL_DEFAULT;  // of the IMU learn/classify
 static uint8_t vector[128];
+
+// Samples of the enabled sources are fused into one, accelerometer X,Y,Z
+// first, once each source has delivered a new reading; both run at the same
+// rate, so a fused sample holds readings of the same instant.
+static uint8_t pme_sample[6];
+static uint32_t pme_sample_ready = 0;  // sources in pme_sample so far
+
+// Classification events to x86: only when the category changes, or when the
+// distance crosses half the maximum influence field (the same gesture getting
+// certain or doubtful), and like the AIO change events, no more often than every
+// PME_EVENT_INTERVAL ms; a change held back goes out with a later window if
+// it persists.
+#define PME_EVENT_INTERVAL  200  // ms
+static uint32_t pme_window = 0;              // vectors classified
+#define PME_EVENT_NONE      0xFFFF  // no category sent yet
+static uint16_t pme_event_category = PME_EVENT_NONE;  // last sent
+static bool pme_event_confident = false;
+static uint32_t pme_event_time = 0;
+
+// Learning only marks the network as changed; it is saved PME_SAVE_DELAY
+// after the first change, so a training session erases and writes a flash
+// slot once instead of once per vector. TYPE_PME_SAVE saves right away.
+#define PME_SAVE_DELAY      5000  // ms
+static struct k_timer pme_save_timer;
+static bool pme_save_scheduled = false;
+
+// accelerometer features: +/-4G in milli m/s^2, saturating beyond
+#define PME_ACCEL_RANGE_MILLI 39227
+static pme_quant_t accel_quant;
+// gyroscope features: +/-500 deg/s in milli rad/s, saturating beyond
+#define PME_GYRO_RANGE_MILLI 8727
+static pme_quant_t gyro_quant;
 #endif
 
 int ipm_send_msg(struct zjs_ipm_message *msg)
@@ -143,41 +223,60 @@ static uint32_t pin_read(uint8_t pin)
 
 static void queue_message(struct zjs_ipm_message *incoming_msg)
 {
-    struct zjs_ipm_message *msg = msg_queue;
+    uint32_t head = queue_head;
 
     if (!incoming_msg) {
         return;
     }
 
-    k_sem_take(&arc_sem, TICKS_UNLIMITED);
-    while(msg && msg < end_of_queue_ptr) {
-       if (msg->id == MSG_ID_DONE) {
-           break;
-       }
-       msg++;
-    }
-
-    if (msg != end_of_queue_ptr) {
-        // copy the message into our queue to be process in the mainloop
-        memcpy(msg, incoming_msg, sizeof(struct zjs_ipm_message));
-    } else {
+    if (head - queue_tail == QUEUE_SIZE) {
         // running out of space, disregard message
-        ERR_PRINT("skipping incoming message\n");
+        queue_dropped++;
+        ERR_PRINT("skipping incoming message, %lu dropped\n", queue_dropped);
+        zjs_ipm_release(incoming_msg);
+        return;
     }
-    k_sem_give(&arc_sem);
+
+    msg_queue[head & (QUEUE_SIZE - 1)] = incoming_msg;
+    queue_barrier();
+    queue_head = head + 1;
+    k_sem_give(&work_sem);
 }
 
 static void ipm_msg_receive_callback(void *context, uint32_t id, volatile void *data)
 {
-    struct zjs_ipm_message *incoming_msg = (struct zjs_ipm_message*)(*(uintptr_t *)data);
+    // NULL for the ring attach doorbell, which carries no message
+    struct zjs_ipm_message *incoming_msg = zjs_ipm_receive(id, data);
     if (incoming_msg) {
         queue_message(incoming_msg);
-    } else {
-        ERR_PRINT("message is NULL\n");
     }
 }
 
 #ifdef BUILD_MODULE_AIO
+static struct k_timer aio_timer;
+
+static void aio_timer_expired(struct k_timer *timer)
+{
+    signal_work(WORK_AIO_UPDATE);
+}
+
+// only poll the pins while someone is subscribed
+static void update_aio_poll(void)
+{
+    bool poll = false;
+    for (int i = 0; i < ARC_AIO_LEN; i++) {
+        poll |= pin_send_updates[i];
+    }
+
+    if (poll) {
+        uint32_t period = AIO_UPDATE_INTERVAL * 1000 /
+                          CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+        k_timer_start(&aio_timer, period, period);
+    } else {
+        k_timer_stop(&aio_timer);
+    }
+}
+
 static void handle_aio(struct zjs_ipm_message *msg)
 {
     uint32_t pin = msg->data.aio.pin;
@@ -429,69 +528,176 @@ static void send_sensor_data(enum sensor_channel channel,
     ipm_send_msg(&msg);
 }
 
-#define ABS(x) ((x) >= 0) ? (x) : -(x)
+#define ABS(x) (((x) >= 0) ? (x) : -(x))
+
+// According to documentation, the value is represented as having an integer
+// and a fractional part, val1 + val2 * 10^(-6). The ARC has no FPU, so it is
+// scaled to milli-units instead of converted to double.
+static inline int32_t sensor_value_to_milli(const struct sensor_value *val)
+{
+    return val->val1 * 1000 + val->val2 / 1000;
+}
+
+#ifdef BUILD_MODULE_PME
 
-static double convert_sensor_value(const struct sensor_value *val)
+static void pme_send_event(const classifyResult *best)
 {
-    // According to documentation, the value is represented as having an
-    // integer and a fractional part, and can be obtained using the formula
-    // val1 + val2 * 10^(-6).
-    return  (double)val->val1 + (double)val->val2 * 0.000001;
+    // the MAXIF the network was configured with, not a copy of it
+    bool confident = best->distance <= getMAXIF() / 2;
+    uint32_t now = k_uptime_get_32();
+
+    pme_window++;
+    if (best->category == pme_event_category &&
+        confident == pme_event_confident) {
+        return;
+    }
+    if (now - pme_event_time < PME_EVENT_INTERVAL) {
+        return;
+    }
+
+    struct zjs_ipm_message msg;
+    msg.id = MSG_ID_PME;
+    msg.type = TYPE_PME_EVENT_CLASSIFIED;
+    msg.flags = 0;
+    msg.user_data = NULL;
+    msg.data.pme_event.category = best->category;
+    msg.data.pme_event.distance = best->distance;
+    msg.data.pme_event.nid = best->nid;
+    msg.data.pme_event.context = pme_model;
+    msg.data.pme_event.timestamp = now;
+    msg.data.pme_event.window = pme_window;
+    if (ipm_send_msg(&msg) != 0) {
+        return;  // ring full, try again with the next window
+    }
+
+    pme_event_category = best->category;
+    pme_event_confident = confident;
+    pme_event_time = now;
 }
 
+// add an X,Y,Z reading (milli-units) of one source, learning or classifying
+// whenever a window is complete
+static void pme_feed(uint32_t source, const pme_quant_t *quant,
+                     const int32_t *milli)
+{
+    if (pme_mode == PME_MODE_NO_OP || !(pme_data_source & source)) {
+        return;
+    }
+
+    uint32_t offset = 0;
+    if (source == PME_DATA_SOURCE_GYRO &&
+        (pme_data_source & PME_DATA_SOURCE_ACCEL)) {
+        offset = 3;
+    }
+
+    pme_sample[offset + 0] = pme_quantize(quant, milli[0]);
+    pme_sample[offset + 1] = pme_quantize(quant, milli[1]);
+    pme_sample[offset + 2] = pme_quantize(quant, milli[2]);
+
+    pme_sample_ready |= source;
+    if (pme_sample_ready != pme_data_source) {
+        return;  // waiting for the other source
+    }
+    pme_sample_ready = 0;
+
+    if (!pme_process_sample(pme_sample, sizeof(pme_sample), vector)) {
+        return;
+    }
+
+    if (pme_mode == PME_MODE_LEARN) {
+        pme_model_learn(pme_model, vector, sizeof(vector), pme_category);
+        PME_INFO("%s: learning done.\n", __FUNCTION__);
+        pme_mode = PME_MODE_NO_OP;
+        memset(vector, 0, sizeof(vector));
+    } else if (pme_mode == PME_MODE_CLASSIFY) {
+        classifyResult best;
+        uint16_t category = pme_model_classify(pme_model, vector,
+                                               sizeof(vector), &best);
+        PME_INFO("%s: classify category=%d\n", __FUNCTION__, category);
+        pme_send_event(&best);
+    }
+}
+
+// Readings of the sensor trigger thread are handed to the main loop, so all
+// PME work (and the model selection of pme_model.c it relies on) stays on
+// one thread. Single producer / single consumer like msg_queue.
+#define PME_READING_QUEUE 32  // power of two
+
+typedef struct pme_reading {
+    uint32_t source;
+    int32_t milli[3];
+} pme_reading_t;
+
+static pme_reading_t pme_readings[PME_READING_QUEUE];
+static volatile uint32_t pme_readings_head = 0;  // written by the trigger thread
+static volatile uint32_t pme_readings_tail = 0;  // written by the main loop
+static uint32_t pme_readings_dropped = 0;
+
+static void pme_post(uint32_t source, const int32_t *milli)
+{
+    uint32_t head = pme_readings_head;
+
+    // a stale mode only costs a reading that pme_feed() ignores
+    if (pme_mode == PME_MODE_NO_OP || !(pme_data_source & source)) {
+        return;
+    }
+
+    if (head - pme_readings_tail == PME_READING_QUEUE) {
+        pme_readings_dropped++;
+        ERR_PRINT("main loop behind, %lu readings dropped\n",
+                  pme_readings_dropped);
+        return;
+    }
+
+    pme_reading_t *reading = &pme_readings[head & (PME_READING_QUEUE - 1)];
+    reading->source = source;
+    memcpy(reading->milli, milli, sizeof(reading->milli));
+    queue_barrier();
+    pme_readings_head = head + 1;
+    signal_work(WORK_PME_READINGS);
+}
+
+static void pme_drain_readings(void)
+{
+    uint32_t tail = pme_readings_tail;
+
+    while (tail != pme_readings_head) {
+        pme_reading_t *reading = &pme_readings[tail & (PME_READING_QUEUE - 1)];
+        pme_feed(reading->source, reading->source == PME_DATA_SOURCE_GYRO ?
+                                  &gyro_quant : &accel_quant, reading->milli);
+        queue_barrier();
+        pme_readings_tail = ++tail;
+    }
+}
+#endif
+
 static void process_accel_data(struct device *dev)
 {
     struct sensor_value val[3];
-    double dval[3];
+    int32_t milli[3];
 
     if (sensor_channel_get(dev, SENSOR_CHAN_ACCEL_XYZ, val) < 0) {
         ERR_PRINT("failed to read accelerometer channels\n");
         return;
     }
 
-    dval[0] = convert_sensor_value(&val[0]);
-    dval[1] = convert_sensor_value(&val[1]);
-    dval[2] = convert_sensor_value(&val[2]);
+    milli[0] = sensor_value_to_milli(&val[0]);
+    milli[1] = sensor_value_to_milli(&val[1]);
+    milli[2] = sensor_value_to_milli(&val[2]);
 
-    // set slope threshold to 0.1G (0.1 * 9.80665 = 4.903325 m/s^2)
-    double threshold = 0.980665;
-    if (ABS(dval[0] - accel_last_value[0]) > threshold ||
-        ABS(dval[1] - accel_last_value[1]) > threshold ||
-        ABS(dval[2] - accel_last_value[2]) > threshold) {
+    // only report changes above the slope threshold
+    if (ABS(milli[0] - accel_last_value[0]) > ACCEL_SLOPE_MILLI ||
+        ABS(milli[1] - accel_last_value[1]) > ACCEL_SLOPE_MILLI ||
+        ABS(milli[2] - accel_last_value[2]) > ACCEL_SLOPE_MILLI) {
         union sensor_reading reading;
-        accel_last_value[0] = reading.x = dval[0];
-        accel_last_value[1] = reading.y = dval[1];
-        accel_last_value[2] = reading.z = dval[2];
+        accel_last_value[0] = reading.x = milli[0];
+        accel_last_value[1] = reading.y = milli[1];
+        accel_last_value[2] = reading.z = milli[2];
         send_sensor_data(SENSOR_CHAN_ACCEL_XYZ, reading);
     }
 
 #ifdef BUILD_MODULE_PME
-    // HACK: we need raw sensor data for PME, I guess...
-    if (pme_mode != PME_MODE_NO_OP) {
-
-        uint8_t raw[3];
-
-        raw[0] = (uint8_t)val[0].val1; 
-        raw[1] = (uint8_t)val[1].val1; 
-        raw[2] = (uint8_t)val[2].val1; 
-#if 0
-        printf("VAL: %5d %5d %5d %5d %5d %5d\n",
-            val[0].val1, val[0].val2, val[1].val1, val[1].val2, val[2].val1, val[2].val2);
-        
-        printf("RAW: %5d %5d %5d\n", raw[0], raw[1], raw[2]);
-#endif
-        if (pme_process_sample(raw, 3, vector)) {
-            if (pme_mode == PME_MODE_LEARN) {
-                pme_learn(vector, sizeof(vector), pme_category);
-                printf("%s: learning done.\n", __FUNCTION__);
-                pme_mode = PME_MODE_NO_OP;
-                memset(vector, 0, sizeof(vector));
-            } else if (pme_mode == PME_MODE_CLASSIFY) {
-                uint16_t category = pme_classify(vector, sizeof(vector));            
-                printf("%s: classify category=%d\n", __FUNCTION__, category);
-            }
-        }
-    }
+    pme_post(PME_DATA_SOURCE_ACCEL, milli);
 #endif
 
 #ifdef DEBUG_BUILD
@@ -507,27 +713,31 @@ static void process_accel_data(struct device *dev)
 static void process_gyro_data(struct device *dev)
 {
     struct sensor_value val[3];
-    double dval[3];
+    int32_t milli[3];
 
     if (sensor_channel_get(dev, SENSOR_CHAN_GYRO_XYZ, val) < 0) {
         ERR_PRINT("failed to read gyroscope channels\n");
         return;
     }
 
-    dval[0] = convert_sensor_value(&val[0]);
-    dval[1] = convert_sensor_value(&val[1]);
-    dval[2] = convert_sensor_value(&val[2]);
+    milli[0] = sensor_value_to_milli(&val[0]);
+    milli[1] = sensor_value_to_milli(&val[1]);
+    milli[2] = sensor_value_to_milli(&val[2]);
 
-    if (dval[0] != gyro_last_value[0] ||
-        dval[1] != gyro_last_value[1] ||
-        dval[2] != gyro_last_value[2]) {
+    if (milli[0] != gyro_last_value[0] ||
+        milli[1] != gyro_last_value[1] ||
+        milli[2] != gyro_last_value[2]) {
         union sensor_reading reading;
-        gyro_last_value[0] = reading.x = dval[0];
-        gyro_last_value[1] = reading.y = dval[1];
-        gyro_last_value[2] = reading.z = dval[2];
+        gyro_last_value[0] = reading.x = milli[0];
+        gyro_last_value[1] = reading.y = milli[1];
+        gyro_last_value[2] = reading.z = milli[2];
         send_sensor_data(SENSOR_CHAN_GYRO_XYZ, reading);
     }
 
+#ifdef BUILD_MODULE_PME
+    pme_post(PME_DATA_SOURCE_GYRO, milli);
+#endif
+
 #ifdef DEBUG_BUILD
     char buf_x[18], buf_y[18], buf_z[18];
 
@@ -710,6 +920,110 @@ static int stop_gyro_trigger(struct device *dev)
     return 0;
 }
 
+#ifdef BUILD_MODULE_PME
+// Without the data ready triggers (no sensor started over IPM) the PME
+// samples through the BMI160 FIFO: an interrupt per PME_FIFO_WATERMARK
+// frames, all of them read in a few SPI bursts.
+#ifndef PME_FIFO_FREQ
+#define PME_FIFO_FREQ      100  // Hz
+#endif
+#ifndef PME_FIFO_WATERMARK
+#define PME_FIFO_WATERMARK 16   // frames
+#endif
+
+static bmi160_fifo_frame_t fifo_frames[32];
+
+static void pme_fifo_ready(void)
+{
+    signal_work(WORK_SENSOR_FIFO);
+}
+
+// run the FIFO while the PME wants samples and no trigger provides them
+static void pme_fifo_update(void)
+{
+    struct sensor_value attr;
+
+    if (pme_mode == PME_MODE_NO_OP || accel_trigger || gyro_trigger) {
+        if (bmi160_fifo_running() && bmi160_fifo_stop(bmi160) != 0) {
+            ERR_PRINT("failed to stop the BMI160 FIFO\n");
+        }
+        return;
+    }
+
+    if (!bmi160) {
+        bmi160 = device_get_binding(BMI160_NAME);
+        if (!bmi160) {
+            ERR_PRINT("failed to initialize BMI160 sensor\n");
+            return;
+        }
+    }
+
+    attr.val1 = PME_FIFO_FREQ;
+    attr.val2 = 0;
+    if (sensor_attr_set(bmi160, SENSOR_CHAN_ACCEL_XYZ,
+                        SENSOR_ATTR_SAMPLING_FREQUENCY, &attr) < 0 ||
+        sensor_attr_set(bmi160, SENSOR_CHAN_GYRO_XYZ,
+                        SENSOR_ATTR_SAMPLING_FREQUENCY, &attr) < 0) {
+        ERR_PRINT("failed to set sampling frequency %d\n", PME_FIFO_FREQ);
+        return;
+    }
+
+    // restarting also flushes samples of a previous source
+    if (bmi160_fifo_start(bmi160, pme_data_source & PME_DATA_SOURCE_ACCEL,
+                          pme_data_source & PME_DATA_SOURCE_GYRO,
+                          PME_FIFO_WATERMARK, pme_fifo_ready) != 0) {
+        ERR_PRINT("failed to start the BMI160 FIFO\n");
+    }
+}
+
+static void pme_fifo_drain(void)
+{
+    int count;
+
+    do {
+        count = bmi160_fifo_read(bmi160, fifo_frames, ARRAY_SIZE(fifo_frames));
+        for (int i = 0; i < count; i++) {
+            pme_feed(PME_DATA_SOURCE_ACCEL, &accel_quant, fifo_frames[i].accel);
+            pme_feed(PME_DATA_SOURCE_GYRO, &gyro_quant, fifo_frames[i].gyro);
+        }
+    } while (count == (int)ARRAY_SIZE(fifo_frames));
+
+    // learning stops after one vector
+    if (pme_mode == PME_MODE_NO_OP) {
+        pme_fifo_update();
+    }
+}
+#endif
+
+static struct k_timer sensor_timer;
+
+static void sensor_timer_expired(struct k_timer *timer)
+{
+    signal_work(WORK_SENSOR_POLL);
+}
+
+// only poll while a polled sensor is started
+static void update_sensor_poll(void)
+{
+    bool poll = temp_poll;
+#ifdef BUILD_MODULE_SENSOR_LIGHT
+    for (int i = 0; i < ARC_AIO_LEN; i++) {
+        poll |= light_send_updates[i];
+    }
+#endif
+
+    if (poll && sensor_poll_freq) {
+        // a 0 period would make it a one-shot timer, poll at most every ms
+        uint32_t period = 1000 / sensor_poll_freq;
+        if (period == 0) {
+            period = 1;
+        }
+        k_timer_start(&sensor_timer, period, period);
+    } else {
+        k_timer_stop(&sensor_timer);
+    }
+}
+
 static void fetch_sensor()
 {
     // ToDo: currently only supports BMI160 temperature
@@ -727,31 +1041,27 @@ static void fetch_sensor()
         }
 
         union sensor_reading reading;
-        double dval = convert_sensor_value(&val);
-        if (dval != temp_last_value) {
-            reading.dval = temp_last_value = dval;
+        reading.value = sensor_value_to_milli(&val);
+        if (reading.value != temp_last_value) {
+            temp_last_value = reading.value;
             send_sensor_data(SENSOR_CHAN_TEMP, reading);
         }
     }
 }
 
 #ifdef BUILD_MODULE_SENSOR_LIGHT
-static double cube_root_recursive(double num, double low, double high) {
-    // calculate approximated cube root value of a number recursively
-    double margin = 0.0001;
-    double mid = (low + high) / 2.0;
-    double mid3 = mid * mid * mid;
-    double diff = mid3 - num;
-    if (ABS(diff) < margin)
-        return mid;
-    else if (mid3 > num)
-        return cube_root_recursive(num, low, mid);
-    else
-        return cube_root_recursive(num, mid, high);
-}
-
-static double cube_root(double num) {
-    return cube_root_recursive(num, 0, num);
+// integer cube root (rounded down), one result bit per step
+static uint32_t cube_root(uint64_t num) {
+    uint64_t root = 0;
+    for (int shift = 63; shift >= 0; shift -= 3) {
+        root <<= 1;
+        uint64_t bit = 3 * root * (root + 1) + 1;
+        if ((num >> shift) >= bit) {
+            num -= bit << shift;
+            root++;
+        }
+    }
+    return (uint32_t)root;
 }
 
 static void fetch_light()
@@ -764,22 +1074,23 @@ static void fetch_light()
                 // the UPM project:
                 //   https://github.com/intel-iot-devkit/upm/blob/master/src/grove/grove.cxx#L161
                 // v = 10000.0/pow(((1023.0-a)*10.0/a)*15.0,4.0/3.0)
-                // since pow() is not supported due to missing <math.h>
-                // we can calculate using conversion where
-                // x^(4/3) is cube root of x^4, where we can
-                // multiply base 4 times and take the cube root
-                double resistance, base;
+                // without floating point, x^(4/3) is x * cbrt(x); with
+                // x = 150 * (1023 - a) / a, cbrt(x * 2^30) = cbrt(x) * 2^10
+                // keeps the fraction, so in milli-lux
+                // v = 10^7 * a * 2^10 / (150 * (1023 - a) * cbrt(x * 2^30))
                 union sensor_reading reading;
                 // rescale sample from 12bit (Zephyr) to 10bit (Grove)
                 uint16_t analog_val = pin_values[i] >> 2;
                 if (analog_val > 1015) {
                     // any thing over 1015 will be considered maximum brightness
-                    reading.dval = 10000.0;
-                }
-                else {
-                    resistance = (1023.0 - analog_val) * 10.0 / analog_val;
-                    base = resistance * 15.0;
-                    reading.dval = 10000.0 / cube_root(base * base * base * base);
+                    reading.value = 10000 * 1000;
+                } else if (analog_val == 0) {
+                    reading.value = 0;  // no light, infinite resistance
+                } else {
+                    uint64_t base = 150 * (1023 - analog_val);
+                    uint32_t root = cube_root((base << 30) / analog_val);
+                    reading.value = (10000000ULL * analog_val << 10) /
+                                    (base * root);
                 }
                 send_sensor_data(SENSOR_CHAN_LIGHT, reading);
             }
@@ -856,6 +1167,11 @@ static void handle_sensor_bmi160(struct zjs_ipm_message *msg)
         error_code = ERROR_IPM_NOT_SUPPORTED;
     }
 
+#ifdef BUILD_MODULE_PME
+    // the triggers take over from the FIFO and hand back to it
+    pme_fifo_update();
+#endif
+
     if (error_code != ERROR_IPM_NONE) {
         ipm_send_error(msg, error_code);
         return;
@@ -944,50 +1260,284 @@ static void handle_sensor(struct zjs_ipm_message *msg)
 
 #ifdef BUILD_MODULE_PME
 
+static neuronData chunk_neurons[ZJS_PME_CHUNK_NEURONS];
+
+// copy up to chunk->count neurons, starting at chunk->first, into the
+// reply; its IPM record only has room for as many as were requested. The
+// chain stays where the chunk ended for the next one, see
+// CuriePME_exportKnowledge(), and each neuron carries its vector up to the
+// last non-zero component.
+static uint32_t pme_read_chunk(struct pme_chunk *chunk)
+{
+    if (chunk->count > ZJS_PME_CHUNK_NEURONS) {
+        ERR_PRINT("neuron chunk of %u too large\n", chunk->count);
+        return ERROR_IPM_INVALID_PARAMETER;
+    }
+
+    uint16_t count = CuriePME_exportKnowledge(chunk_neurons, chunk->first,
+                                              chunk->count, maxVectorSize);
+
+    for (int i = 0; i < count; i++) {
+        struct pme_data *out = &chunk->neuron[i];
+        out->context = chunk_neurons[i].context;
+        out->influence = chunk_neurons[i].influence;
+        out->minInfluence = chunk_neurons[i].minInfluence;
+        out->category = chunk_neurons[i].category;
+        out->count = pme_image_vector_count(&chunk_neurons[i]);
+        memcpy(out->vector, chunk_neurons[i].vector, out->count);
+    }
+    chunk->count = count;
+    chunk->total = CuriePME_getCommittedCount();
+
+#ifdef PME_TRACE
+    if (chunk->first == 0) {
+        pme_trace_dump();
+    }
+#endif
+    return ERROR_IPM_NONE;
+}
+
+// write a chunk into the network, chunks are expected in order and the one
+// at first 0 replaces the network. chunk->total is the size of the whole
+// transfer, the network gets stored once the last chunk is in.
+static uint32_t pme_write_chunk(struct pme_chunk *chunk)
+{
+    uint16_t total = chunk->total;
+
+    if (chunk->count > ZJS_PME_CHUNK_NEURONS ||
+        chunk->first > CuriePME_getCommittedCount()) {
+        ERR_PRINT("neuron chunk %u out of order\n", chunk->first);
+        return ERROR_IPM_INVALID_PARAMETER;
+    }
+
+    // the PME zeroes components past vector_length, the longest vector in
+    // the chunk
+    uint16_t vector_length = 0;
+    for (int i = 0; i < chunk->count; i++) {
+        struct pme_data *in = &chunk->neuron[i];
+        uint16_t length = in->count;
+        if (length > maxVectorSize)
+            length = maxVectorSize;
+        if (length > vector_length)
+            vector_length = length;
+        chunk_neurons[i].context = in->context;
+        chunk_neurons[i].influence = in->influence;
+        chunk_neurons[i].minInfluence = in->minInfluence;
+        chunk_neurons[i].category = in->category;
+        memcpy(chunk_neurons[i].vector, in->vector, length);
+        memset(&chunk_neurons[i].vector[length], 0, maxVectorSize - length);
+    }
+
+#ifdef SOFT_PME
+    // the transfer only covers the PME, a new network starts without a pool
+    if (chunk->first == 0) {
+        pme_hybrid_forget();
+    }
+#endif
+    chunk->total = CuriePME_importKnowledge(chunk_neurons, chunk->first,
+                                            chunk->count, vector_length);
+    if (chunk->first + chunk->count >= total) {
+        CuriePME_endTransfer();
+        PME_INFO("%s: %u neurons written\n", __FUNCTION__, chunk->total);
+        pme_model_init();
+        if (pme_store_save() != 0) {
+            return ERROR_IPM_OPERATION_FAILED;
+        }
+    }
+    return ERROR_IPM_NONE;
+}
+
+// vectors handed to the PME at a time from a batch message
+#define PME_BATCH_SLICE 32
+
+static uint32_t pme_run_batch(struct pme_batch *batch, bool learn)
+{
+    static pme_model_request_t requests[PME_BATCH_SLICE];
+    uint32_t dropped = 0;  // vectors the full pool had no room for
+
+    if (!batch->entries || batch->len == 0 || batch->len > maxVectorSize ||
+        (batch->context && !pme_model_valid(batch->context))) {
+        return ERROR_IPM_INVALID_PARAMETER;
+    }
+
+    for (uint32_t first = 0; first < batch->count; first += PME_BATCH_SLICE) {
+        uint32_t n = batch->count - first;
+        if (n > PME_BATCH_SLICE) {
+            n = PME_BATCH_SLICE;
+        }
+
+        pme_batch_entry_t *entries = &batch->entries[first];
+        for (uint32_t i = 0; i < n; i++) {
+            requests[i].model = batch->context;
+            requests[i].vector = entries[i].vector;
+            requests[i].len = batch->len;
+            requests[i].category = entries[i].category;
+        }
+
+        if (learn) {
+            batch->committed = pme_model_learn_batch(requests, n);
+            for (uint32_t i = 0; i < n; i++) {
+                if (requests[i].category == noMatch) {
+                    dropped++;
+                }
+            }
+        } else {
+            pme_model_classify_batch(requests, n);
+            for (uint32_t i = 0; i < n; i++) {
+                entries[i].category = requests[i].category;
+            }
+        }
+    }
+
+    // once for the whole batch
+    if (learn && pme_store_save() != 0) {
+        return ERROR_IPM_OPERATION_FAILED;
+    }
+    if (dropped) {
+        ERR_PRINT("%lu batch vectors not learned\n", dropped);
+        return ERROR_IPM_OPERATION_FAILED;
+    }
+    return ERROR_IPM_NONE;
+}
+
+static void pme_save_timer_expired(struct k_timer *timer)
+{
+    signal_work(WORK_PME_SAVE);
+}
+
+// start the save timer for a network that changed since the last save, a
+// failed save stays changed and is retried
+static void pme_schedule_save(void)
+{
+    if (pme_store_dirty() && !pme_save_scheduled) {
+        pme_save_scheduled = true;
+        k_timer_start(&pme_save_timer, PME_SAVE_DELAY, 0);
+    }
+}
+
+// select the sensors of the IMU vectors, restarting the window if they change
+static void pme_set_source(uint32_t source)
+{
+    if (source == pme_data_source) {
+        return;
+    }
+
+    pme_data_source = source;
+    pme_sample_ready = 0;
+    pme_set_sample_size(source == (PME_DATA_SOURCE_ACCEL | PME_DATA_SOURCE_GYRO) ?
+                        6 : 3);
+    memset(vector, 0, sizeof(vector));
+}
+
 static void handle_pme(struct zjs_ipm_message* msg)
 {
     uint32_t error_code = ERROR_IPM_NONE;
   
     switch(msg->type) {
     case TYPE_PME_INIT:
+        // restoring would drop changes not saved yet
+        pme_store_flush();
         pme_init();
+        pme_model_init();
+        pme_data_source = PME_DATA_SOURCE_ACCEL;  // as pme_init() sets up
+        pme_sample_ready = 0;
         break;
     case TYPE_PME_LEARN_TEST:
 
-        printf("learn: %d %d %d len=%d category=%d\n", 
+        PME_DBG("learn: %d %d %d len=%d category=%d model=%d\n",
             msg->data.pme.vector[0], msg->data.pme.vector[1], 
-            msg->data.pme.vector[2], msg->data.pme.count, msg->data.pme.category);
+            msg->data.pme.vector[2], msg->data.pme.count, msg->data.pme.category,
+            msg->data.pme.context);
 
+        if (msg->data.pme.context && !pme_model_valid(msg->data.pme.context)) {
+            error_code = ERROR_IPM_INVALID_PARAMETER;
+            break;
+        }
         pme_mode = PME_MODE_LEARN;
-        pme_data_source = PME_DATA_SOURCE_ACCEL; // TODO: from ipm msg    
-        pme_learn(msg->data.pme.vector, msg->data.pme.count,
-            msg->data.pme.category);
-
-        printf("count: %d\n", CuriePME_getCommittedCount());
-        break;
-    case TYPE_PME_CLASSIFY_TEST:
+        if (pme_model_learn(msg->data.pme.context, msg->data.pme.vector,
+            msg->data.pme.count, msg->data.pme.category) < 0) {
+            error_code = ERROR_IPM_OPERATION_FAILED;
+        }
 
-        printf("classify: %d %d %d len=%d\n", 
-            msg->data.pme.vector[0], msg->data.pme.vector[1], 
-            msg->data.pme.vector[2], msg->data.pme.count);
-        pme_mode = PME_MODE_CLASSIFY;
-        msg->data.pme.category = pme_classify(msg->data.pme.vector, 
-            msg->data.pme.count);
+        PME_INFO("count: %d\n", CuriePME_getCommittedCount());
         break;
+    // TYPE_PME_CLASSIFY_TEST is batched, see handle_pme_classify()
 
     case TYPE_PME_LEARN_IMU:
-        pme_mode = PME_MODE_LEARN;
-        pme_data_source = PME_DATA_SOURCE_ACCEL; // TODO: from ipm msg
-        pme_category = msg->data.pme.category;
-        printf("Neuros: %d\n", CuriePME_getCommittedCount());
-        break;
     case TYPE_PME_CLASSIFY_IMU:
-        pme_mode = PME_MODE_CLASSIFY;
-        pme_data_source = PME_DATA_SOURCE_ACCEL; // TODO: from ipm msg    
-        printf("Neuros: %d\n", CuriePME_getCommittedCount());
+        if ((msg->data.pme.context && !pme_model_valid(msg->data.pme.context)) ||
+            (msg->data.pme.source & ~(PME_DATA_SOURCE_ACCEL |
+                                      PME_DATA_SOURCE_GYRO))) {
+            error_code = ERROR_IPM_INVALID_PARAMETER;
+            break;
+        }
+        pme_model = msg->data.pme.context ? msg->data.pme.context :
+                                            PME_MODEL_DEFAULT;
+        pme_set_source(msg->data.pme.source ? msg->data.pme.source :
+                                              PME_DATA_SOURCE_ACCEL);
+        if (msg->type == TYPE_PME_LEARN_IMU) {
+            pme_mode = PME_MODE_LEARN;
+            pme_category = msg->data.pme.category;
+        } else {
+            pme_mode = PME_MODE_CLASSIFY;
+            // a new run, the first result is always an event
+            pme_window = 0;
+            pme_event_category = PME_EVENT_NONE;
+            pme_event_time = k_uptime_get_32() - PME_EVENT_INTERVAL;
+        }
+#ifdef BUILD_MODULE_SENSOR
+        pme_fifo_update();
+#endif
+        PME_INFO("Neuros: %d\n", CuriePME_getCommittedCount());
+        break;
+    case TYPE_PME_MODEL_CREATE:
+        msg->data.pme.context = pme_model_create();
+        if (msg->data.pme.context == 0) {
+            error_code = ERROR_IPM_OPERATION_FAILED;
+        }
+        break;
+    case TYPE_PME_SEGMENT:
+        if (msg->data.pme.count == PME_SEGMENT_DEFAULT) {
+            // the slope threshold of the accelerometer events
+            int32_t slope = PME_ACCEL_RANGE_MILLI / 40;  // 0.1G
+            pme_set_segmentation(pme_quantize(&accel_quant, slope) -
+                                 pme_quantize(&accel_quant, 0));
+        } else {
+            pme_set_segmentation(msg->data.pme.count);
+        }
+        memset(vector, 0, sizeof(vector));
+        break;
+    case TYPE_PME_WINDOW:
+        if (msg->data.pme.count == 0 || msg->data.pme.category == 0) {
+            error_code = ERROR_IPM_INVALID_PARAMETER;
+            break;
+        }
+        pme_set_window(msg->data.pme.count, msg->data.pme.category);
+        memset(vector, 0, sizeof(vector));
+        break;
+    case TYPE_PME_LEARN_BATCH:
+        error_code = pme_run_batch(&msg->data.pme_batch, true);
+        break;
+    case TYPE_PME_CLASSIFY_BATCH:
+        error_code = pme_run_batch(&msg->data.pme_batch, false);
         break;
     case TYPE_PME_READ_NEURONS:
-        pme_read();
+        error_code = pme_read_chunk(&msg->data.pme_chunk);
+        break;
+    case TYPE_PME_WRITE_NEURONS:
+        error_code = pme_write_chunk(&msg->data.pme_chunk);
+        break;
+    case TYPE_PME_BENCH:
+        pme_bench_bcast(msg->data.pme.count);
+        break;
+    case TYPE_PME_SAVE:
+        if (pme_store_flush() != 0) {
+            error_code = ERROR_IPM_OPERATION_FAILED;
+        }
+        break;
+    case TYPE_PME_FORGET:
+        pme_forget();
+        pme_model_init();
         break;
 
     default:
@@ -1001,18 +1551,54 @@ static void handle_pme(struct zjs_ipm_message* msg)
     }
     zjs_ipm_send(msg->id, msg);
 }
+
+// classify the run of TYPE_PME_CLASSIFY_TEST requests at the queue tail in
+// one go, grouped by model, returns how many were handled
+static uint32_t handle_pme_classify(uint32_t tail)
+{
+    static pme_model_request_t requests[QUEUE_SIZE];
+    uint32_t count = 0;
+
+    while (tail + count != queue_head && count < QUEUE_SIZE) {
+        struct zjs_ipm_message *msg = msg_queue[(tail + count) & (QUEUE_SIZE - 1)];
+        if (msg->id != MSG_ID_PME || msg->type != TYPE_PME_CLASSIFY_TEST) {
+            break;
+        }
+        requests[count].model = msg->data.pme.context;
+        requests[count].vector = msg->data.pme.vector;
+        requests[count].len = msg->data.pme.count;
+        count++;
+    }
+
+    pme_mode = PME_MODE_CLASSIFY;
+    pme_model_classify_batch(requests, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct zjs_ipm_message *msg = msg_queue[(tail + i) & (QUEUE_SIZE - 1)];
+        if (msg->data.pme.context && !pme_model_valid(msg->data.pme.context)) {
+            ipm_send_error(msg, ERROR_IPM_INVALID_PARAMETER);
+            continue;
+        }
+        msg->data.pme.category = requests[i].category;
+        zjs_ipm_send(msg->id, msg);
+    }
+    return count;
+}
 #endif // BUILD_MODULE_PME
 
 static void process_messages()
 {
-    struct zjs_ipm_message *msg = msg_queue;
+    uint32_t tail = queue_tail;
+
+    // process all queued messages in arrival order
+    while (tail != queue_head) {
+       struct zjs_ipm_message *msg = msg_queue[tail & (QUEUE_SIZE - 1)];
 
-    while (msg && msg < end_of_queue_ptr) {
-        // loop through all messages and process them
        switch(msg->id) {
 #ifdef BUILD_MODULE_AIO
        case MSG_ID_AIO:
            handle_aio(msg);
+           update_aio_poll();
            break;
 #endif
 #ifdef BUILD_MODULE_I2C
@@ -1028,23 +1614,40 @@ static void process_messages()
 #ifdef BUILD_MODULE_SENSOR
        case MSG_ID_SENSOR:
            handle_sensor(msg);
+           update_sensor_poll();
            break;
 #endif
 #ifdef BUILD_MODULE_PME
        case MSG_ID_PME:
+           // only neuron chunks continue a transfer through the chain
+           if (msg->type != TYPE_PME_READ_NEURONS &&
+               msg->type != TYPE_PME_WRITE_NEURONS) {
+               CuriePME_endTransfer();
+           }
+           if (msg->type == TYPE_PME_CLASSIFY_TEST) {
+               uint32_t count = handle_pme_classify(tail);
+               // all but the last, which is released below
+               while (--count) {
+                   zjs_ipm_release(msg);
+                   queue_barrier();
+                   queue_tail = ++tail;
+                   msg = msg_queue[tail & (QUEUE_SIZE - 1)];
+               }
+               break;
+           }
            handle_pme(msg);
            break;
 #endif
-       case MSG_ID_DONE:
-           return;
        default:
            ERR_PRINT("unsupported ipm message id: %lu, check ARC modules\n",
                      msg->id);
            ipm_send_error(msg, ERROR_IPM_NOT_SUPPORTED);
        }
 
-       msg->id = MSG_ID_DONE;
-       msg++;
+       // replies are copied out, the record can go back to x86
+       zjs_ipm_release(msg);
+       queue_barrier();
+       queue_tail = ++tail;
     }
 }
 
@@ -1052,38 +1655,76 @@ void main(void)
 {
     ZJS_PRINT("Sensor core running ZJS ARC support image\n");
 
-    k_sem_init(&arc_sem, 0, 1);
-    k_sem_give(&arc_sem);
-
-    memset(msg_queue, 0, sizeof(struct zjs_ipm_message) * QUEUE_SIZE);
+    memset(msg_queue, 0, sizeof(msg_queue));
+    k_sem_init(&work_sem, 0, 1);
+#ifdef BUILD_MODULE_AIO
+    k_timer_init(&aio_timer, aio_timer_expired, NULL);
+#endif
+#ifdef BUILD_MODULE_SENSOR
+    k_timer_init(&sensor_timer, sensor_timer_expired, NULL);
+#endif
+#ifdef BUILD_MODULE_PME
+    k_timer_init(&pme_save_timer, pme_save_timer_expired, NULL);
+#endif
 
     zjs_ipm_init();
     zjs_ipm_register_callback(-1, ipm_msg_receive_callback); // MSG_ID ignored
 
+#ifdef BUILD_MODULE_PME
+    pme_quant_init(&accel_quant, -PME_ACCEL_RANGE_MILLI,
+                   PME_ACCEL_RANGE_MILLI, 0);
+    pme_quant_init(&gyro_quant, -PME_GYRO_RANGE_MILLI,
+                   PME_GYRO_RANGE_MILLI, 0);
+    // restores the stored network, no retraining after a reset
+    pme_init();
+    pme_model_init();
+#endif
+
 #if defined(BUILD_MODULE_AIO) || defined(BUILD_MODULE_SENSOR_LIGHT)
     adc_dev = device_get_binding(ADC_DEVICE_NAME);
     adc_enable(adc_dev);
 #endif
 
-    int tick_count = 0;
     while (1) {
+        // sleep until a message or a poll timer needs us
+        k_sem_take(&work_sem, TICKS_UNLIMITED);
         process_messages();
+
+        uint32_t work = take_work();
+#ifdef BUILD_MODULE_PME
+        // the PME work below needs the chain out of a neuron transfer
+        if (work & (WORK_SENSOR_FIFO | WORK_PME_READINGS | WORK_PME_SAVE)) {
+            CuriePME_endTransfer();
+        }
+#endif
 #ifdef BUILD_MODULE_AIO
-        if (tick_count % AIO_UPDATE_INTERVAL == 0) {
+        if (work & WORK_AIO_UPDATE) {
             process_aio_updates();
         }
 #endif
 #ifdef BUILD_MODULE_SENSOR
-        if (tick_count % (uint32_t)(CONFIG_SYS_CLOCK_TICKS_PER_SEC /
-                                    sensor_poll_freq) == 0) {
+        if (work & WORK_SENSOR_POLL) {
             fetch_sensor();
 #ifdef BUILD_MODULE_SENSOR_LIGHT
             fetch_light();
 #endif
         }
+#ifdef BUILD_MODULE_PME
+        if (work & WORK_SENSOR_FIFO) {
+            pme_fifo_drain();
+        }
+        if (work & WORK_PME_READINGS) {
+            pme_drain_readings();
+        }
+#endif
+#endif
+#ifdef BUILD_MODULE_PME
+        if (work & WORK_PME_SAVE) {
+            pme_save_scheduled = false;
+            pme_store_flush();
+        }
+        pme_schedule_save();
 #endif
-        tick_count += SLEEP_TICKS;
-        k_sleep(SLEEP_TICKS);
     }
 
 #if defined(BUILD_MODULE_AIO) || defined(BUILD_MODULE_SENSOR_LIGHT)
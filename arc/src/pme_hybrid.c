@@ -0,0 +1,197 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifdef __ZEPHYR__
+#include <zephyr.h>
+#endif
+#include <CuriePME.h>
+#include <string.h>
+
+#include "SoftPME.h"
+#include "pme_hybrid.h"
+#include "pme_log.h"
+#include "pme_store.h"
+
+#define HYBRID_TOPK_MAX 16  // per tier, larger k is clamped
+
+static uint16_t hw_hits[128];
+static uint16_t pool_hits[SOFT_PME_MAX_NEURONS];
+static uint32_t classified = 0;
+
+// the pool follows the PME configuration
+static void sync_pool(void)
+{
+	PATTERN_MATCHING_CLASSIFICATION_MODE mode = CuriePME_getClassifierMode();
+
+	SoftPME_configure(CuriePME_getGlobalContext(), CuriePME_getDistanceMode(),
+		mode, getMINIF(), getMAXIF());
+	SoftPME_setClassifierMode(mode);
+	SoftPME_setNeuronContext(CuriePME_getNeuronContext());
+}
+
+// halve the hit counters so they follow recent use
+static void age_hits(void)
+{
+	for (int n = 0; n < 128; n++)
+		hw_hits[n] >>= 1;
+	for (int n = 0; n < SOFT_PME_MAX_NEURONS; n++)
+		pool_hits[n] >>= 1;
+}
+
+static int pme_full(void)
+{
+	return CuriePME_getCommittedCount() >= maxNeurons;
+}
+
+void pme_hybrid_forget(void)
+{
+	CuriePME_forget();
+	SoftPME_forget();
+	memset(hw_hits, 0, sizeof(hw_hits));
+	memset(pool_hits, 0, sizeof(pool_hits));
+	classified = 0;
+}
+
+int32_t pme_hybrid_learn(uint8_t *vector, int32_t len, uint16_t category)
+{
+	uint16_t distance;
+	uint16_t firing;
+	int recognized = 0;
+	uint16_t nearest = 0xFFFF;
+
+	category &= CAT_CATEGORY;
+
+	// the pool only fills up once the PME is full, until then the PME
+	// is the whole network
+	if (!pme_full())
+		return CuriePME_learn(vector, len, category);
+
+	PATTERN_MATCHING_CLASSIFICATION_MODE mode = CuriePME_getClassifierMode();
+
+	// does a PME neuron of this category recognize the vector?
+	CuriePME_setClassifierMode(RBF_Mode);
+	CuriePME_bcast_vector(vector, len);
+	while ((firing = CuriePME_classify_next(NULL, NULL)) != noMatch) {
+		if (firing == category) {
+			recognized = 1;
+			break;
+		}
+	}
+
+	// the closest PME neuron of another category bounds a new pool neuron
+	CuriePME_setClassifierMode(KNN_Mode);
+	CuriePME_bcast_vector(vector, len);
+	while ((firing = CuriePME_classify_next(&distance, NULL)) != noMatch) {
+		if (firing != category) {
+			nearest = distance;
+			break;
+		}
+	}
+
+	CuriePME_setClassifierMode(mode);
+
+	// the PME cannot commit any more, but shrinks its neurons
+	CuriePME_learn(vector, len, category);
+
+	sync_pool();
+	if (SoftPME_learn_bounded(vector, len, category, nearest, recognized) ==
+		SOFT_PME_FULL) {
+		PME_ERR("%s: pool full, category %d not learned\n", __FUNCTION__,
+			category);
+		return -1;
+	}
+
+	return pme_hybrid_getCommittedCount();
+}
+
+uint16_t pme_hybrid_classify_topk(uint8_t *vector, int32_t len, uint16_t k,
+	classifyResult *results)
+{
+	classifyResult hw[HYBRID_TOPK_MAX];
+	classifyResult pool[HYBRID_TOPK_MAX];
+	uint16_t hw_count, pool_count = 0;
+	uint16_t count = 0, i = 0, j = 0;
+
+	if (k > HYBRID_TOPK_MAX)
+		k = HYBRID_TOPK_MAX;
+
+	hw_count = CuriePME_classify_topk(vector, len, k, hw);
+	if (SoftPME_getCommittedCount()) {
+		sync_pool();
+		pool_count = SoftPME_classify_topk(vector, len, k, pool);
+	}
+
+	// merge by distance, the PME first on a tie like the lower neuron ID
+	while (count < k && (i < hw_count || j < pool_count)) {
+		if (j >= pool_count || (i < hw_count && hw[i].distance <= pool[j].distance)) {
+			results[count++] = hw[i++];
+		} else {
+			results[count] = pool[j++];
+			results[count++].nid += maxNeurons;
+		}
+	}
+
+	if (count) {
+		uint16_t nid = results[0].nid;
+		uint16_t *hits = (nid > maxNeurons) ? &pool_hits[nid - maxNeurons - 1] :
+			&hw_hits[nid - 1];
+
+		// age instead of saturating
+		if (++*hits == 0xFFFF)
+			age_hits();
+	}
+
+	if (pool_count && ++classified >= PME_HYBRID_REBALANCE_PERIOD) {
+		classified = 0;
+		pme_hybrid_rebalance();
+	}
+
+	return count;
+}
+
+uint16_t pme_hybrid_getCommittedCount(void)
+{
+	return CuriePME_getCommittedCount() + SoftPME_getCommittedCount();
+}
+
+uint16_t pme_hybrid_rebalance(void)
+{
+	uint16_t hw_count = CuriePME_getCommittedCount();
+	uint16_t pool_count = SoftPME_getCommittedCount();
+	uint16_t swaps = 0;
+	neuronData hot, cold;
+
+	for (;;) {
+		int coldest = 0, hottest = 0;
+
+		for (int n = 1; n < hw_count; n++) {
+			if (hw_hits[n] < hw_hits[coldest])
+				coldest = n;
+		}
+		for (int n = 1; n < pool_count; n++) {
+			if (pool_hits[n] > pool_hits[hottest])
+				hottest = n;
+		}
+
+		if (!hw_count || !pool_count || pool_hits[hottest] <= hw_hits[coldest])
+			break;
+
+		CuriePME_readNeuron(coldest + 1, &cold);
+		SoftPME_readNeuron(hottest + 1, &hot);
+		CuriePME_writeNeuron(coldest + 1, &hot);
+		SoftPME_writeNeuron(hottest + 1, &cold);
+
+		uint16_t hits = hw_hits[coldest];
+		hw_hits[coldest] = pool_hits[hottest];
+		pool_hits[hottest] = hits;
+		swaps++;
+	}
+
+	age_hits();
+
+	// the pool is not persisted, keep the swapped in neurons
+	if (swaps) {
+		PME_DBG("%s: %d neurons moved to the PME\n", __FUNCTION__, swaps);
+		pme_store_touch();
+	}
+	return swaps;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef __pme_hybrid_h__
+#define __pme_hybrid_h__
+
+#include <stdint.h>
+#include <CuriePME.h>
+
+// Two tier classifier: the PME neurons first, then a SoftPME pool once all
+// 128 hardware neurons are committed. Learning treats both tiers as one
+// RBF network (recognition, shrinking and the new neuron's influence field
+// take every neuron into account), classification merges the firing
+// neurons of both by distance. Pool neurons have IDs above maxNeurons.
+//
+// Every top match counts as a hit for its neuron; pme_hybrid_rebalance()
+// swaps pool neurons that are hit more often than hardware ones into the
+// PME, so the common case stays on the accelerator.
+//
+// The PME configuration (context, modes, MINIF/MAXIF) is the master copy,
+// the pool follows it.
+//
+// Only the PME tier is saved (pme_store.h), the pool starts out empty after
+// a reset. A rebalance marks the network as changed, so the neurons swapped
+// into the PME are saved with it.
+
+#ifndef PME_HYBRID_REBALANCE_PERIOD
+#define PME_HYBRID_REBALANCE_PERIOD 256  // classifications between rebalancing
+#endif
+
+// forget both tiers
+void pme_hybrid_forget(void);
+
+// returns the number of committed neurons in both tiers, or -1 if the vector
+// needed a new neuron and the pool is full (SOFT_PME_MAX_NEURONS)
+int32_t pme_hybrid_learn(uint8_t *vector, int32_t len, uint16_t category);
+
+// up to k firing neurons of both tiers ordered by distance, returns the
+// number found
+uint16_t pme_hybrid_classify_topk(uint8_t *vector, int32_t len, uint16_t k,
+	classifyResult *results);
+
+uint16_t pme_hybrid_getCommittedCount(void);
+
+// swap hot pool neurons into the PME, returns the number of swaps
+uint16_t pme_hybrid_rebalance(void);
+
+#endif  // __pme_hybrid_h__
@@ -0,0 +1,298 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifdef __ZEPHYR__
+#include <zephyr.h>
+#endif
+#include <CuriePME.h>
+#include <string.h>
+
+#include "pme_image.h"
+#include "pme_log.h"
+
+static uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+	while (len--) {
+		crc ^= (uint16_t)*data++ << 8;
+		for (int i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static uint16_t crc16(const uint8_t *data, uint32_t len)
+{
+	return crc16_update(0xFFFF, data, len);
+}
+
+static void put16(uint8_t *buf, uint16_t value)
+{
+	buf[0] = value & 0xFF;
+	buf[1] = value >> 8;
+}
+
+static uint16_t get16(const uint8_t *buf)
+{
+	return buf[0] | (buf[1] << 8);
+}
+
+// returns the encoded size, or -1 if it does not fit in space; never more
+// than count + 1 bytes (PME_IMAGE_MAX_SIZE)
+static int32_t encode(const uint8_t *vector, uint32_t count, uint8_t flags,
+	uint8_t *out, uint32_t space)
+{
+	uint8_t tmp[128];
+	uint8_t packed[2 * 128];  // at most 2 bytes per component
+	uint32_t i = 0, o = 0;
+
+	for (i = 0; i < count; i++)
+		tmp[i] = (flags & PME_IMAGE_DELTA) && i ? vector[i] - vector[i - 1] : vector[i];
+
+	if (!(flags & PME_IMAGE_RLE)) {
+		if (count > space)
+			return -1;
+		memcpy(out, tmp, count);
+		return count;
+	}
+
+	i = 0;
+	while (i < count) {
+		uint32_t run = 1;
+		while (i + run < count && run < 129 && tmp[i + run] == tmp[i])
+			run++;
+
+		if (run >= 2) {
+			packed[o++] = 0x80 + run - 2;
+			packed[o++] = tmp[i];
+			i += run;
+			continue;
+		}
+
+		// literals up to the start of the next run
+		uint32_t start = i, literals = 0;
+		while (i < count && literals < 128) {
+			if (literals && i + 1 < count && tmp[i + 1] == tmp[i])
+				break;
+			i++;
+			literals++;
+		}
+		packed[o++] = literals - 1;
+		memcpy(&packed[o], &tmp[start], literals);
+		o += literals;
+	}
+
+	// short runs between literals cost more than they save, one literal
+	// block is never longer than count + 1
+	if (count && o > count + 1) {
+		packed[0] = count - 1;
+		memcpy(&packed[1], tmp, count);
+		o = count + 1;
+	}
+
+	if (o > space)
+		return -1;
+	memcpy(out, packed, o);
+	return o;
+}
+
+// returns the number of input bytes used, or -1 if the input is corrupt
+static int32_t decode(const uint8_t *in, uint32_t len, uint8_t flags,
+	uint8_t *vector, uint32_t count)
+{
+	uint32_t i = 0, o = 0;
+
+	if (!(flags & PME_IMAGE_RLE)) {
+		if (count > len)
+			return -1;
+		memcpy(vector, in, count);
+		i = count;
+	} else {
+		while (o < count) {
+			if (i >= len)
+				return -1;
+			uint8_t control = in[i++];
+			if (control & 0x80) {
+				uint32_t run = control - 0x80 + 2;
+				if (i >= len || o + run > count)
+					return -1;
+				memset(&vector[o], in[i++], run);
+				o += run;
+			} else {
+				uint32_t literals = control + 1;
+				if (i + literals > len || o + literals > count)
+					return -1;
+				memcpy(&vector[o], &in[i], literals);
+				i += literals;
+				o += literals;
+			}
+		}
+	}
+
+	if (flags & PME_IMAGE_DELTA) {
+		for (o = 1; o < count; o++)
+			vector[o] += vector[o - 1];
+	}
+
+	return i;
+}
+
+uint8_t pme_image_vector_count(const neuronData *neuron)
+{
+	uint8_t count = maxVectorSize;
+
+	while (count && neuron->vector[count - 1] == 0)
+		count--;
+	return count;
+}
+
+int32_t pme_image_write(pme_image_sink_t sink, void *ctx, uint8_t flags)
+{
+	neuronData neuron;
+	uint8_t buf[PME_IMAGE_NEURON_SIZE + 128 + 1];
+	uint16_t neurons = CuriePME_getCommittedCount();
+	uint16_t crc = 0xFFFF;
+	int32_t pos = PME_IMAGE_HEADER_SIZE;
+	int32_t ret = -1;
+
+	buf[0] = 'P';
+	buf[1] = 'M';
+	buf[2] = PME_IMAGE_VERSION;
+	buf[3] = flags & (PME_IMAGE_DELTA | PME_IMAGE_RLE);
+	put16(&buf[4], neurons);
+	buf[6] = 0;
+	buf[7] = 0;
+	put16(&buf[8], getGCR());
+	put16(&buf[10], getNSR());
+	put16(&buf[12], getMINIF());
+	put16(&buf[14], getMAXIF());
+	flags = buf[3];
+
+	crc = crc16_update(crc, buf, PME_IMAGE_HEADER_SIZE);
+	if (sink(ctx, buf, PME_IMAGE_HEADER_SIZE) != 0)
+		return -1;
+
+	CuriePME_beginSaveMode();
+
+	for (int n = 0; n < neurons; n++) {
+		CuriePME_iterateNeuronsToSave(&neuron);
+
+		uint8_t count = pme_image_vector_count(&neuron);
+		put16(&buf[0], neuron.context);
+		put16(&buf[2], neuron.influence);
+		put16(&buf[4], neuron.minInfluence);
+		put16(&buf[6], neuron.category);
+		buf[8] = count;
+
+		int32_t len = encode(neuron.vector, count, flags,
+			&buf[PME_IMAGE_NEURON_SIZE], sizeof(buf) - PME_IMAGE_NEURON_SIZE);
+		if (len < 0)
+			goto out;
+		len += PME_IMAGE_NEURON_SIZE;
+
+		crc = crc16_update(crc, buf, len);
+		if (sink(ctx, buf, len) != 0)
+			goto out;
+		pos += len;
+	}
+
+	put16(&buf[0], crc);
+	if (sink(ctx, buf, 2) == 0)
+		ret = pos + 2;
+
+out:
+	CuriePME_endSaveMode();
+	return ret;
+}
+
+typedef struct buffer_sink {
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t pos;
+} buffer_sink_t;
+
+static int buffer_write(void *ctx, const uint8_t *data, uint32_t len)
+{
+	buffer_sink_t *out = ctx;
+
+	if (out->pos + len > out->size)
+		return -1;
+	memcpy(&out->buf[out->pos], data, len);
+	out->pos += len;
+	return 0;
+}
+
+int32_t pme_image_save(uint8_t *buf, uint32_t size, uint8_t flags)
+{
+	buffer_sink_t out = { buf, size, 0 };
+	int32_t ret = pme_image_write(buffer_write, &out, flags);
+
+	if (ret < 0)
+		PME_ERR("%s: image does not fit in %lu bytes\n", __FUNCTION__,
+			(unsigned long)size);
+	return ret;
+}
+
+int32_t pme_image_load(const uint8_t *buf, uint32_t len)
+{
+	neuronData neuron;
+	uint32_t pos = PME_IMAGE_HEADER_SIZE;
+
+	if (len < PME_IMAGE_HEADER_SIZE + 2 || buf[0] != 'P' || buf[1] != 'M' ||
+		buf[2] != PME_IMAGE_VERSION) {
+		PME_ERR("%s: not a knowledge image\n", __FUNCTION__);
+		return -1;
+	}
+
+	if (crc16(buf, len - 2) != get16(&buf[len - 2])) {
+		PME_ERR("%s: bad checksum\n", __FUNCTION__);
+		return -1;
+	}
+
+	uint8_t flags = buf[3];
+	uint16_t neurons = get16(&buf[4]);
+	uint16_t gcr = get16(&buf[8]);
+	uint16_t nsr = get16(&buf[10]);
+
+	if (neurons > maxNeurons)
+		return -1;
+
+	// validate the whole image before the network gets forgotten
+	for (int n = 0; n < neurons; n++) {
+		if (pos + PME_IMAGE_NEURON_SIZE > len - 2)
+			return -1;
+		uint8_t count = buf[pos + 8];
+		pos += PME_IMAGE_NEURON_SIZE;
+		if (count > maxVectorSize)
+			return -1;
+		int32_t used = decode(&buf[pos], len - 2 - pos, flags, neuron.vector, count);
+		if (used < 0)
+			return -1;
+		pos += used;
+	}
+
+	pos = PME_IMAGE_HEADER_SIZE;
+	CuriePME_beginRestoreMode();
+
+	for (int n = 0; n < neurons; n++) {
+		neuron.context = get16(&buf[pos]);
+		neuron.influence = get16(&buf[pos + 2]);
+		neuron.minInfluence = get16(&buf[pos + 4]);
+		neuron.category = get16(&buf[pos + 6]);
+		uint8_t count = buf[pos + 8];
+		pos += PME_IMAGE_NEURON_SIZE;
+
+		memset(neuron.vector, 0, sizeof(neuron.vector));
+		pos += decode(&buf[pos], len - 2 - pos, flags, neuron.vector, count);
+
+		CuriePME_iterateNeuronsToRestore(&neuron);
+	}
+
+	CuriePME_endRestoreMode();
+
+	CuriePME_configure(gcr & GCR_GLOBAL,
+		(gcr & GCR_DIST) ? LSUP_Distance : L1_Distance,
+		(nsr & NSR_CLASS_MODE) ? KNN_Mode : RBF_Mode,
+		get16(&buf[12]), get16(&buf[14]));
+	CuriePME_setClassifierMode((nsr & NSR_CLASS_MODE) ? KNN_Mode : RBF_Mode);
+
+	return neurons;
+}
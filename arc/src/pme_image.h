@@ -0,0 +1,53 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef __pme_image_h__
+#define __pme_image_h__
+
+#include <stdint.h>
+#include <CuriePME.h>
+
+// Serialized PME knowledge image, all fields little endian:
+//
+//   header   'P' 'M', version, flags, neuron count (16), reserved (16),
+//            GCR, NSR, MINIF, MAXIF (16 each)
+//   neurons  context, influence, minInfluence, category (16 each),
+//            component count (8), encoded components
+//   trailer  CRC-16/CCITT of everything before it
+//
+// Each neuron stores its vector up to the last non-zero component. With
+// PME_IMAGE_DELTA the components are stored as differences to the previous
+// one, with PME_IMAGE_RLE runs are packed (control byte < 0x80: that many
+// plus one literal bytes follow; >= 0x80: the next byte repeats
+// control - 0x80 + 2 times).
+
+#define PME_IMAGE_VERSION     1
+#define PME_IMAGE_HEADER_SIZE 16
+#define PME_IMAGE_NEURON_SIZE 9     // without the components
+
+#define PME_IMAGE_DELTA       0x01
+#define PME_IMAGE_RLE         0x02
+
+// largest possible image for a full network
+#define PME_IMAGE_MAX_SIZE \
+	(PME_IMAGE_HEADER_SIZE + 128 * (PME_IMAGE_NEURON_SIZE + 128 + 1) + 2)
+
+// serialize the network into buf, returns the image size or -1 if it
+// does not fit
+int32_t pme_image_save(uint8_t *buf, uint32_t size, uint8_t flags);
+
+// receives the image in order, a header, one piece per neuron and the
+// trailer; returns 0 to go on
+typedef int (*pme_image_sink_t)(void *ctx, const uint8_t *data, uint32_t len);
+
+// serialize the network piece by piece, without a buffer for the whole
+// image; returns the image size or -1 if the sink failed
+int32_t pme_image_write(pme_image_sink_t sink, void *ctx, uint8_t flags);
+
+// components of neuron up to the last non-zero one, what an image stores
+uint8_t pme_image_vector_count(const neuronData *neuron);
+
+// replace the network with the image in buf, returns the number of
+// neurons restored or -1 if the image is invalid
+int32_t pme_image_load(const uint8_t *buf, uint32_t len);
+
+#endif  // __pme_image_h__
@@ -0,0 +1,35 @@
+// Copyright (c) 2017, Intel Corporation.
+
+#include "pme_log.h"
+
+#ifdef PME_TRACE
+
+static pme_trace_entry_t trace_ring[PME_TRACE_SIZE];
+static uint32_t trace_head = 0;  // total records written
+
+void pme_trace_record(uint16_t event, uint16_t a, uint16_t b)
+{
+    pme_trace_entry_t *entry = &trace_ring[trace_head & (PME_TRACE_SIZE - 1)];
+
+    entry->cycles = pme_cycles();
+    entry->event = event;
+    entry->a = a;
+    entry->b = b;
+    trace_head++;
+}
+
+void pme_trace_dump(void)
+{
+    uint32_t start = 0;
+
+    if (trace_head > PME_TRACE_SIZE)
+        start = trace_head - PME_TRACE_SIZE;
+
+    for (uint32_t i = start; i < trace_head; i++) {
+        pme_trace_entry_t *entry = &trace_ring[i & (PME_TRACE_SIZE - 1)];
+        PME_PRINT("trace: %lu ev=%u a=%u b=%u\n", (unsigned long)entry->cycles,
+                  entry->event, entry->a, entry->b);
+    }
+}
+
+#endif // PME_TRACE
@@ -0,0 +1,98 @@
+// Copyright (c) 2017, Intel Corporation.
+
+#ifndef __pme_log_h__
+#define __pme_log_h__
+
+// Leveled logging for the PME sample/learn/classify path. Everything above
+// PME_LOG_LEVEL is compiled out, so release builds do no formatting at all.
+// Same shape as DBG_PRINT/ERR_PRINT in zjs_common.h, without the file/line
+// prefix which costs more than the message on the ARC console.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PME_LOG_LEVEL_NONE 0
+#define PME_LOG_LEVEL_ERR  1
+#define PME_LOG_LEVEL_INFO 2
+#define PME_LOG_LEVEL_DBG  3
+
+#ifndef PME_LOG_LEVEL
+#ifdef DEBUG_BUILD
+#define PME_LOG_LEVEL PME_LOG_LEVEL_DBG
+#else
+#define PME_LOG_LEVEL PME_LOG_LEVEL_ERR
+#endif
+#endif
+
+#define PME_PRINT printf
+
+#if PME_LOG_LEVEL >= PME_LOG_LEVEL_ERR
+#define PME_ERR(fmat, ...) PME_PRINT("[PME ERROR] " fmat, ##__VA_ARGS__)
+#else
+#define PME_ERR(fmat, ...) do {} while (0)
+#endif
+
+#if PME_LOG_LEVEL >= PME_LOG_LEVEL_INFO
+#define PME_INFO(fmat, ...) PME_PRINT(fmat, ##__VA_ARGS__)
+#else
+#define PME_INFO(fmat, ...) do {} while (0)
+#endif
+
+#if PME_LOG_LEVEL >= PME_LOG_LEVEL_DBG
+#define PME_DBG(fmat, ...) PME_PRINT(fmat, ##__VA_ARGS__)
+#define PME_DBG_VECTOR(vector, len) \
+    do { \
+        for (int _i = 0; _i < (int)(len); _i++) \
+            PME_PRINT("%d ", (vector)[_i]); \
+        PME_PRINT("\n"); \
+    } while (0)
+#else
+#define PME_DBG(fmat, ...) do {} while (0)
+#define PME_DBG_VECTOR(vector, len) do {} while (0)
+#endif
+
+#ifdef __ZEPHYR__
+#include <zephyr.h>
+#define pme_cycles() k_cycle_get_32()
+#else
+#include <time.h>
+
+// host build: nanoseconds instead of cycles
+static inline uint32_t pme_cycles(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+#endif
+
+// Binary trace ring for deep debugging: fixed-size records with a cycle
+// stamp, no formatting until pme_trace_dump() is called.
+#ifdef PME_TRACE
+
+#ifndef PME_TRACE_SIZE
+#define PME_TRACE_SIZE 64  // entries, must be a power of two
+#endif
+
+enum {
+    PME_TRACE_LEARN = 1,     // a = category, b = committed neurons
+    PME_TRACE_CLASSIFY,      // a = best category, b = best distance
+    PME_TRACE_VECTOR,        // a = vector length, b = first component
+};
+
+typedef struct pme_trace_entry {
+    uint32_t cycles;
+    uint16_t event;
+    uint16_t a;
+    uint16_t b;
+} pme_trace_entry_t;
+
+void pme_trace_record(uint16_t event, uint16_t a, uint16_t b);
+void pme_trace_dump(void);
+
+#define PME_TRACE_EVENT(event, a, b) pme_trace_record(event, a, b)
+#else
+#define PME_TRACE_EVENT(event, a, b) do {} while (0)
+#endif
+
+#endif  // __pme_log_h__
@@ -0,0 +1,164 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifdef __ZEPHYR__
+#include <zephyr.h>
+#endif
+#include <CuriePME.h>
+#include <algo.h>
+#include <string.h>
+
+#include "pme_log.h"
+#include "pme_model.h"
+
+static uint32_t models[(PME_MODEL_MAX + 1 + 31) / 32];  // contexts in use
+static uint16_t selected = PME_MODEL_DEFAULT;
+
+static void mark(uint16_t model)
+{
+	models[model >> 5] |= 1UL << (model & 31);
+}
+
+int pme_model_valid(uint16_t model)
+{
+	if (model == 0 || model > PME_MODEL_MAX)
+		return 0;
+	return (models[model >> 5] >> (model & 31)) & 1;
+}
+
+void pme_model_init(void)
+{
+	uint16_t neurons = CuriePME_getCommittedCount();
+
+	memset(models, 0, sizeof(models));
+	mark(PME_MODEL_DEFAULT);
+
+	// every context with neurons is a model; reading CAT moves the chain
+	CuriePME_beginSaveMode();
+	for (int i = 0; i < neurons; i++) {
+		uint16_t context = getNCR() & NCR_CONTEXT;
+		if (context)
+			mark(context);
+		getCAT();
+	}
+	CuriePME_endSaveMode();
+
+	selected = CuriePME_getGlobalContext();
+}
+
+uint16_t pme_model_create(void)
+{
+	for (uint16_t model = 1; model <= PME_MODEL_MAX; model++) {
+		if (!pme_model_valid(model)) {
+			mark(model);
+			PME_INFO("%s: model %d\n", __FUNCTION__, model);
+			return model;
+		}
+	}
+	return 0;
+}
+
+// make model the global and the learning context, unless it already is
+static void select_model(uint16_t model)
+{
+	if (model == selected)
+		return;
+
+	CuriePME_setGlobalContext(model);
+	CuriePME_setNeuronContext(model);
+	selected = model;
+}
+
+int32_t pme_model_learn(uint16_t model, uint8_t *vector, uint32_t len, uint16_t category)
+{
+	if (model == 0)
+		model = PME_MODEL_DEFAULT;
+	if (!pme_model_valid(model))
+		return CuriePME_getCommittedCount();
+
+	select_model(model);
+	return pme_learn(vector, len, category);
+}
+
+uint16_t pme_model_classify(uint16_t model, uint8_t *vector, uint32_t len,
+	classifyResult *best)
+{
+	if (model == 0)
+		model = PME_MODEL_DEFAULT;
+	if (!pme_model_valid(model)) {
+		if (best) {
+			best->category = noMatch;
+			best->distance = 0xFFFF;
+			best->nid = 0;
+		}
+		return noMatch;
+	}
+
+	select_model(model);
+	return pme_classify_best(vector, len, best);
+}
+
+// the model a request runs with, 0 if it can never be valid
+static uint16_t request_model(const pme_model_request_t *request)
+{
+	if (request->model == 0)
+		return PME_MODEL_DEFAULT;
+	return (request->model > PME_MODEL_MAX) ? 0 : request->model;
+}
+
+// run learn or classify for all requests, one model after the other;
+// returns the committed count after the last learned vector
+static uint16_t run_batch(pme_model_request_t *requests, uint32_t count, int learn)
+{
+	uint32_t seen[sizeof(models) / sizeof(models[0])] = { 0 };
+	uint16_t model = selected;  // no switch for the first group
+	uint16_t committed = CuriePME_getCommittedCount();
+
+	while (count) {
+		seen[model >> 5] |= 1UL << (model & 31);
+
+		if (pme_model_valid(model)) {
+			for (uint32_t i = 0; i < count; i++) {
+				if (request_model(&requests[i]) != model)
+					continue;
+				select_model(model);
+				if (learn) {
+					int32_t result = pme_learn(requests[i].vector,
+						requests[i].len, requests[i].category);
+					if (result < 0)
+						requests[i].category = noMatch;  // not learned
+					else
+						committed = result;
+				} else
+					requests[i].category = pme_classify(requests[i].vector,
+						requests[i].len);
+			}
+		}
+
+		// the next model in request order
+		uint16_t next = 0;
+		for (uint32_t i = 0; i < count && !next; i++) {
+			uint16_t m = request_model(&requests[i]);
+			if (!((seen[m >> 5] >> (m & 31)) & 1))
+				next = m;
+		}
+		if (!next)
+			break;
+		model = next;
+	}
+	return committed;
+}
+
+void pme_model_classify_batch(pme_model_request_t *requests, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+		requests[i].category = noMatch;  // stays for an unknown model
+
+	run_batch(requests, count, 0);
+}
+
+uint16_t pme_model_learn_batch(pme_model_request_t *requests, uint32_t count)
+{
+	// learning in one context leaves the others alone, the order only
+	// matters within a model
+	return run_batch(requests, count, 1);
+}
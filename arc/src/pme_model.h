@@ -0,0 +1,52 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef __pme_model_h__
+#define __pme_model_h__
+
+#include <stdint.h>
+#include <CuriePME.h>
+
+// Several classifiers on one neuron array. Each model owns a neuron context
+// (1 to 127): its neurons are learned with that context and only they fire
+// while it is the global context. Switching models rewrites GCR and NCR, so
+// the manager keeps track of the selected one and skips redundant switches,
+// and batches of classify requests are run grouped by model. That cache is
+// not locked: all PME work, learning and classifying included, has to run on
+// one thread (the ARC main loop).
+
+#define PME_MODEL_DEFAULT 1    // the context pme_init selects
+#define PME_MODEL_MAX     127
+
+typedef struct pme_model_request {
+	uint16_t model;      // 0 for PME_MODEL_DEFAULT
+	uint8_t *vector;
+	uint32_t len;
+	uint16_t category;   // learn: input, classify: result (noMatch for an
+	                     // unknown model)
+} pme_model_request_t;
+
+// pick up the models of a restored network, call after pme_init
+void pme_model_init(void);
+
+// assign a free context, returns the new model or 0 if all are taken
+uint16_t pme_model_create(void);
+
+// returns 0 if the model does not exist
+int pme_model_valid(uint16_t model);
+
+// see pme_learn(), -1 if the vector could not be learned
+int32_t pme_model_learn(uint16_t model, uint8_t *vector, uint32_t len, uint16_t category);
+// best (may be NULL) gets the closest firing neuron, see pme_classify_best()
+uint16_t pme_model_classify(uint16_t model, uint8_t *vector, uint32_t len,
+	classifyResult *best);
+
+// classify all requests, switching the context once per model; of the
+// requests only category is written
+void pme_model_classify_batch(pme_model_request_t *requests, uint32_t count);
+// learn all requests the same way, requests of unknown models are skipped
+// and the category of a request that could not be learned is set to
+// noMatch; like pme_learn(), the network is saved later. Returns the
+// committed neuron count.
+uint16_t pme_model_learn_batch(pme_model_request_t *requests, uint32_t count);
+
+#endif  // __pme_model_h__
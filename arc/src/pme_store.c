@@ -0,0 +1,300 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifdef __ZEPHYR__
+#include <zephyr.h>
+#include <flash.h>
+#else
+#include <stdio.h>
+#endif
+#include <string.h>
+
+#include "pme_image.h"
+#include "pme_log.h"
+#include "pme_store.h"
+
+// slot header, written after the image
+#define SLOT_MAGIC       0x54534D50  // "PMST"
+#define SLOT_HEADER_SIZE PME_STORE_HEADER_SIZE
+
+typedef struct slot_header {
+	uint32_t magic;
+	uint32_t sequence;  // incremented on every save
+	uint32_t length;    // image bytes following the header
+	uint32_t check;     // ~length
+} slot_header_t;
+
+// the image goes to flash through this buffer, in whole words
+#define WRITE_CHUNK 256
+
+static int dirty = 0;  // the network differs from the stored copy
+
+typedef struct slot_writer {
+	uint32_t offset;    // of the next flush
+	uint32_t fill;
+	uint8_t chunk[WRITE_CHUNK];
+} slot_writer_t;
+
+// mark --flash access--
+
+#ifdef __ZEPHYR__
+static struct device *flash_dev = NULL;
+
+static int store_open(void)
+{
+	if (!flash_dev)
+		flash_dev = device_get_binding(CONFIG_SOC_FLASH_QMSI_DEV_NAME);
+	return flash_dev ? 0 : -1;
+}
+
+static int store_read(uint32_t offset, void *data, uint32_t len)
+{
+	return flash_read(flash_dev, PME_STORE_OFFSET + offset, data, len);
+}
+
+static int store_write(uint32_t offset, const void *data, uint32_t len)
+{
+	int ret;
+
+	flash_write_protection_set(flash_dev, false);
+	ret = flash_write(flash_dev, PME_STORE_OFFSET + offset, data, len);
+	flash_write_protection_set(flash_dev, true);
+	return ret;
+}
+
+static int store_erase(uint32_t offset, uint32_t len)
+{
+	int ret;
+
+	flash_write_protection_set(flash_dev, false);
+	ret = flash_erase(flash_dev, PME_STORE_OFFSET + offset, len);
+	flash_write_protection_set(flash_dev, true);
+	return ret;
+}
+
+// the flash is memory mapped, images are loaded in place
+static const uint8_t *store_map(uint32_t offset, uint32_t len)
+{
+	return (const uint8_t *)(uintptr_t)(PME_STORE_OFFSET + offset);
+}
+#else
+// host build: a file standing in for the flash, with the same erase/write
+// semantics (erase sets bytes to 0xFF, writes can only clear bits)
+static FILE *flash_file = NULL;
+
+static int store_open(void)
+{
+	if (flash_file)
+		return 0;
+
+	flash_file = fopen(PME_STORE_FILE, "r+b");
+	if (!flash_file) {
+		uint8_t erased[256];
+
+		flash_file = fopen(PME_STORE_FILE, "w+b");
+		if (!flash_file)
+			return -1;
+		memset(erased, 0xFF, sizeof(erased));
+		for (uint32_t i = 0; i < 2 * PME_STORE_SLOT_SIZE; i += sizeof(erased))
+			fwrite(erased, 1, sizeof(erased), flash_file);
+		fflush(flash_file);
+	}
+	return 0;
+}
+
+static int store_read(uint32_t offset, void *data, uint32_t len)
+{
+	if (fseek(flash_file, offset, SEEK_SET) != 0 ||
+		fread(data, 1, len, flash_file) != len)
+		return -1;
+	return 0;
+}
+
+static int store_write(uint32_t offset, const void *data, uint32_t len)
+{
+	const uint8_t *in = data;
+
+	for (uint32_t i = 0; i < len; i++) {
+		uint8_t cell;
+		if (store_read(offset + i, &cell, 1) != 0)
+			return -1;
+		cell &= in[i];
+		if (fseek(flash_file, offset + i, SEEK_SET) != 0 ||
+			fwrite(&cell, 1, 1, flash_file) != 1)
+			return -1;
+	}
+	return fflush(flash_file);
+}
+
+static int store_erase(uint32_t offset, uint32_t len)
+{
+	uint8_t erased[256];
+
+	memset(erased, 0xFF, sizeof(erased));
+	if (fseek(flash_file, offset, SEEK_SET) != 0)
+		return -1;
+	for (uint32_t i = 0; i < len; i += sizeof(erased))
+		fwrite(erased, 1, sizeof(erased), flash_file);
+	return fflush(flash_file);
+}
+
+static const uint8_t *store_map(uint32_t offset, uint32_t len)
+{
+	static uint8_t image[PME_IMAGE_MAX_SIZE];
+
+	if (len > sizeof(image) || store_read(offset, image, len) != 0)
+		return NULL;
+	return image;
+}
+#endif
+
+// mark --slots--
+
+static int slot_valid(const slot_header_t *header)
+{
+	return header->magic == SLOT_MAGIC &&
+		header->check == ~header->length &&
+		header->length <= PME_IMAGE_MAX_SIZE;
+}
+
+// index of the slot with the newest valid copy, -1 if none
+static int newest_slot(slot_header_t headers[2])
+{
+	int newest = -1;
+
+	for (int i = 0; i < 2; i++) {
+		if (store_read(i * PME_STORE_SLOT_SIZE, &headers[i], SLOT_HEADER_SIZE) != 0 ||
+			!slot_valid(&headers[i]))
+			continue;
+		if (newest < 0 || (int32_t)(headers[i].sequence - headers[newest].sequence) > 0)
+			newest = i;
+	}
+	return newest;
+}
+
+static int writer_flush(slot_writer_t *writer)
+{
+	// flash is written in words, pad with erased bytes
+	uint32_t padded = (writer->fill + 3) & ~3;
+
+	memset(&writer->chunk[writer->fill], 0xFF, padded - writer->fill);
+	if (padded && store_write(writer->offset, writer->chunk, padded) != 0)
+		return -1;
+	writer->offset += padded;
+	writer->fill = 0;
+	return 0;
+}
+
+static int writer_write(void *ctx, const uint8_t *data, uint32_t len)
+{
+	slot_writer_t *writer = ctx;
+
+	while (len) {
+		uint32_t n = WRITE_CHUNK - writer->fill;
+		if (n > len)
+			n = len;
+		memcpy(&writer->chunk[writer->fill], data, n);
+		writer->fill += n;
+		data += n;
+		len -= n;
+		if (writer->fill == WRITE_CHUNK && writer_flush(writer) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+int pme_store_save(void)
+{
+	static slot_writer_t writer;
+	slot_header_t headers[2];
+	slot_header_t header;
+
+	if (store_open() != 0) {
+		PME_ERR("%s: no flash\n", __FUNCTION__);
+		return -1;
+	}
+
+	int newest = newest_slot(headers);
+	int slot = (newest == 0) ? 1 : 0;
+	uint32_t base = slot * PME_STORE_SLOT_SIZE;
+
+	writer.offset = base + SLOT_HEADER_SIZE;
+	writer.fill = 0;
+
+	// a slot always holds a full network, the image only fails to go out
+	// if the flash does
+	int32_t len = -1;
+	if (store_erase(base, PME_STORE_SLOT_SIZE) == 0)
+		len = pme_image_write(writer_write, &writer, PME_IMAGE_DELTA | PME_IMAGE_RLE);
+
+	header.magic = SLOT_MAGIC;
+	header.sequence = (newest < 0) ? 1 : headers[newest].sequence + 1;
+	header.length = len;
+	header.check = ~header.length;
+
+	if (len < 0 || writer_flush(&writer) != 0 ||
+		store_write(base, &header, SLOT_HEADER_SIZE) != 0) {
+		PME_ERR("%s: flash write failed, slot %d\n", __FUNCTION__, slot);
+		return -1;
+	}
+
+	PME_DBG("%s: %ld bytes to slot %d, sequence %lu\n", __FUNCTION__, (long)len,
+		slot, (unsigned long)header.sequence);
+	dirty = 0;
+	return 0;
+}
+
+int32_t pme_store_restore(void)
+{
+	slot_header_t headers[2];
+
+	if (store_open() != 0)
+		return -1;
+
+	int newest = newest_slot(headers);
+
+	// fall back to the older copy if the newest one does not load
+	for (int tries = 0; newest >= 0 && tries < 2; tries++) {
+		int32_t neurons = -1;
+		uint32_t base = newest * PME_STORE_SLOT_SIZE;
+		const uint8_t *image = store_map(base + SLOT_HEADER_SIZE,
+			headers[newest].length);
+
+		if (image)
+			neurons = pme_image_load(image, headers[newest].length);
+		if (neurons >= 0) {
+			dirty = 0;
+			return neurons;
+		}
+
+		PME_ERR("%s: slot %d is corrupt\n", __FUNCTION__, newest);
+		newest = !newest;
+		if (!slot_valid(&headers[newest]))
+			break;
+	}
+
+	return -1;
+}
+
+int pme_store_erase(void)
+{
+	if (store_open() != 0)
+		return -1;
+
+	dirty = 0;
+	return store_erase(0, 2 * PME_STORE_SLOT_SIZE);
+}
+
+void pme_store_touch(void)
+{
+	dirty = 1;
+}
+
+int pme_store_dirty(void)
+{
+	return dirty;
+}
+
+int pme_store_flush(void)
+{
+	return dirty ? pme_store_save() : 0;
+}
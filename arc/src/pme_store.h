@@ -0,0 +1,66 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef __pme_store_h__
+#define __pme_store_h__
+
+#include <stdint.h>
+
+#include "pme_image.h"
+
+// Persistent PME knowledge. The network is kept as a pme_image in one of two
+// flash slots; a save always goes to the slot not holding the newest copy
+// and its slot header is written last, so losing power mid-write leaves the
+// previous copy in place.
+//
+// On the board the slots live in on-chip flash at PME_STORE_OFFSET, on a
+// host build in the file PME_STORE_FILE. The image is written to flash a
+// piece at a time and read back in place, so a full network needs no RAM
+// buffer of its size.
+
+#define PME_STORE_PAGE_SIZE   2048  // Quark SE flash page
+#define PME_STORE_HEADER_SIZE 16
+
+// a slot holds the image of a full network, in whole pages
+#define PME_STORE_SLOT_SIZE \
+	((PME_STORE_HEADER_SIZE + PME_IMAGE_MAX_SIZE + PME_STORE_PAGE_SIZE - 1) & \
+	 ~(PME_STORE_PAGE_SIZE - 1))
+
+#ifdef __ZEPHYR__
+// Both slots take the end of the ARC flash partition. prj_arc.conf lowers
+// CONFIG_FLASH_SIZE by their 36KB, so the ARC image is linked in front of
+// them and the link fails if it grows into the store.
+#define PME_STORE_FLASH_END   0x40060000  // end of the ARC partition
+#ifndef PME_STORE_OFFSET
+#define PME_STORE_OFFSET      (PME_STORE_FLASH_END - 2 * PME_STORE_SLOT_SIZE)
+#endif
+#if PME_STORE_OFFSET < CONFIG_FLASH_BASE_ADDRESS + CONFIG_FLASH_SIZE * 1024
+#error "PME store overlaps the ARC image, lower CONFIG_FLASH_SIZE"
+#endif
+#else
+#ifndef PME_STORE_FILE
+#define PME_STORE_FILE        "pme_flash.bin"
+#endif
+#endif
+
+// save the network into the older slot, returns 0 on success or -1 (logged)
+// if the flash could not be written
+int pme_store_save(void);
+
+// restore the newest valid copy, returns the number of neurons restored
+// or -1 if there is none (the network is left untouched)
+int32_t pme_store_restore(void);
+
+// invalidate both slots
+int pme_store_erase(void);
+
+// Saves are coalesced: learning only marks the network as changed, the
+// caller saves it later with pme_store_flush(), e.g. from a timer, instead
+// of erasing and writing a slot for every vector.
+void pme_store_touch(void);
+// 1 if the network changed since the last save or restore
+int pme_store_dirty(void);
+// save if the network changed, returns 0 on success or -1 (logged, the
+// network stays changed)
+int pme_store_flush(void);
+
+#endif  // __pme_store_h__
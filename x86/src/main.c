@@ -19,6 +19,7 @@
 #include <ipm/ipm_quark_se.h>
 
 #include <zjs_ipm.h>
+#include "pme_client.h"
 
 
 #define PME_SHELL_MODULE "pme"
@@ -27,7 +28,27 @@
 
 char *sensor_name = "bmi160";
 
-static struct k_sem sync_sem;
+// neuron chunk requests kept in flight, must leave ring room for others
+#define PME_CHUNK_DEPTH 4
+static struct k_sem chunk_sem;
+static uint32_t chunk_error;
+static uint16_t chunk_total;
+static uint32_t chunk_requests[PME_CHUNK_DEPTH];  // to cancel on a timeout
+
+// where a chunk read goes, one per chunk in flight
+struct pme_chunk_dest {
+    struct pme_data *neurons;
+    uint16_t count;     // room for as many as requested
+};
+static struct pme_chunk_dest chunk_dests[PME_CHUNK_DEPTH];
+
+// network pulled by "pme read", pushed back by "pme write"
+static struct pme_data pme_backup[128];
+static uint16_t pme_backup_count = 0;
+
+// model (neuron context) the shell learns and classifies with, 0: default
+static uint16_t pme_model = 0;
+static uint16_t pme_source = PME_DATA_SOURCE_ACCEL;  // of learn/classify
 
 uint32_t sensor_print = 0;
 
@@ -42,8 +63,7 @@ static int shell_cmd_sensor(int argc, char *argv[])
     }
 
     send.id = MSG_ID_SENSOR;
-    send.flags = 0 | MSG_SYNC_FLAG;
-    send.user_data = (void *)&reply;
+    send.flags = 0;
     send.error_code = ERROR_IPM_NONE;
 
     if (!strcmp(argv[1], "init")) {
@@ -70,15 +90,298 @@ static int shell_cmd_sensor(int argc, char *argv[])
 
     send.data.sensor.controller = sensor_name;
 
-    if (zjs_ipm_send(MSG_ID_SENSOR, &send) != 0) {
-        printk("PME: IPM send failed\n");
+    if (pme_client_call(MSG_ID_SENSOR, &send, &reply,
+                        PME_IPM_TIMEOUT_TICKS) != 0) {
+        printk("FATAL ERROR, ipm timed out\n");
         return ERROR_IPM_OPERATION_FAILED;
     }
-    if (k_sem_take(&sync_sem, PME_IPM_TIMEOUT_TICKS)) {
+
+    return 0;
+}
+
+// chunk reply, a read gets copied to the neurons it was sent for
+static void pme_chunk_done(zjs_ipm_message_t *reply, void *user_data)
+{
+    struct pme_chunk_dest *dest = user_data;
+
+    if (reply->error_code != ERROR_IPM_NONE) {
+        chunk_error = reply->error_code;
+    } else {
+        chunk_total = reply->data.pme_chunk.total;
+        if (reply->type == TYPE_PME_READ_NEURONS) {
+            // never more than the request had room for
+            uint16_t count = reply->data.pme_chunk.count;
+            if (count > dest->count) {
+                count = dest->count;
+            }
+            memcpy(dest->neurons, reply->data.pme_chunk.neuron,
+                   count * sizeof(struct pme_data));
+        }
+    }
+    k_sem_give(&chunk_sem);
+}
+
+// queue one chunk request, returns its request ID or 0
+static uint32_t pme_send_chunk(uint32_t type, uint16_t first, uint16_t count,
+                               uint16_t total, struct pme_chunk_dest *dest)
+{
+    static zjs_ipm_message_t msg;  // the shell thread only
+
+    msg.type = type;
+    msg.flags = 0;
+    msg.error_code = ERROR_IPM_NONE;
+    msg.data.pme_chunk.first = first;
+    msg.data.pme_chunk.count = count;
+    msg.data.pme_chunk.total = total;
+    if (type == TYPE_PME_WRITE_NEURONS) {
+        memcpy(msg.data.pme_chunk.neuron, dest->neurons,
+               count * sizeof(struct pme_data));
+    }
+    return pme_client_send(MSG_ID_PME, &msg, pme_chunk_done, dest);
+}
+
+// move count neurons to or from the ARC, PME_CHUNK_DEPTH chunks at a time.
+// Returns the neurons read, or the committed count after a write, -1 on
+// error.
+static int pme_transfer(uint32_t type, struct pme_data *neurons, uint16_t count)
+{
+    uint16_t next = 0;
+    int inflight = 0;
+
+    // a read learns the network size from the first reply
+    uint16_t total = count;
+    if (type == TYPE_PME_READ_NEURONS && total > ZJS_PME_CHUNK_NEURONS) {
+        total = ZJS_PME_CHUNK_NEURONS;
+    }
+
+    chunk_error = ERROR_IPM_NONE;
+    chunk_total = 0;
+    // stop sending on the first error, but wait for what is in flight
+    while ((next < total && chunk_error == ERROR_IPM_NONE) || inflight) {
+        if (next < total && inflight < PME_CHUNK_DEPTH &&
+            chunk_error == ERROR_IPM_NONE) {
+            uint16_t n = total - next;
+            if (n > ZJS_PME_CHUNK_NEURONS) {
+                n = ZJS_PME_CHUNK_NEURONS;
+            }
+            // replies come in order, the slot of the oldest chunk is free
+            uint32_t slot = (next / ZJS_PME_CHUNK_NEURONS) % PME_CHUNK_DEPTH;
+            chunk_dests[slot].neurons = &neurons[next];
+            chunk_dests[slot].count = n;
+            uint32_t request = pme_send_chunk(type, next, n, count,
+                                              &chunk_dests[slot]);
+            if (!request) {
+                chunk_error = ERROR_IPM_OPERATION_FAILED;
+                continue;
+            }
+            chunk_requests[slot] = request;
+            next += n;
+            inflight++;
+            continue;
+        }
+
+        if (k_sem_take(&chunk_sem, PME_IPM_TIMEOUT_TICKS)) {
+            printk("FATAL ERROR, ipm timed out\n");
+            for (int i = 0; i < PME_CHUNK_DEPTH; i++) {
+                pme_client_cancel(chunk_requests[i]);
+            }
+            k_sem_reset(&chunk_sem);
+            return -1;
+        }
+        inflight--;
+
+        if (type == TYPE_PME_READ_NEURONS && chunk_error == ERROR_IPM_NONE) {
+            total = (chunk_total < count) ? chunk_total : count;
+        }
+    }
+
+    if (chunk_error != ERROR_IPM_NONE) {
+        printk("PME: neuron transfer failed, error %u\n", chunk_error);
+        return -1;
+    }
+    return (type == TYPE_PME_READ_NEURONS) ? total : chunk_total;
+}
+
+static int pme_read_neurons(void)
+{
+    int count = pme_transfer(TYPE_PME_READ_NEURONS, pme_backup,
+                             ARRAY_SIZE(pme_backup));
+    if (count < 0) {
+        return ERROR_IPM_OPERATION_FAILED;
+    }
+
+    pme_backup_count = count;
+    printk("neurons: %d\n", count);
+    for (int i = 0; i < count; i++) {
+        struct pme_data *neuron = &pme_backup[i];
+        printk("Neuron: NID=%d %s CTX=%d AIF=%d MIF=%d cat=%d\n",
+               i + 1, (neuron->context & 0x0040) ? "LSUP" : "L1",
+               neuron->context & 0x007F, neuron->influence,
+               neuron->minInfluence, neuron->category);
+    }
+    return 0;
+}
+
+static int pme_write_neurons(void)
+{
+    if (pme_backup_count == 0) {
+        printk("PME: nothing to write, read the network first\n");
+        return 0;
+    }
+
+    int count = pme_transfer(TYPE_PME_WRITE_NEURONS, pme_backup,
+                             pme_backup_count);
+    if (count < 0) {
+        return ERROR_IPM_OPERATION_FAILED;
+    }
+
+    printk("neurons: %d\n", count);
+    return 0;
+}
+
+// vectors of "pme batch", must stay put until the reply
+#define PME_BATCH_ENTRIES 64
+static pme_batch_entry_t batch_entries[PME_BATCH_ENTRIES];
+
+// learn or classify count vectors of entries in one request
+static int pme_send_batch(uint32_t type, pme_batch_entry_t *entries,
+                          uint16_t count, uint16_t len, uint16_t *committed)
+{
+    zjs_ipm_message_t send;
+    zjs_ipm_message_t reply;
+
+    send.type = type;
+    send.flags = 0;
+    send.error_code = ERROR_IPM_NONE;
+    send.data.pme_batch.entries = entries;
+    send.data.pme_batch.count = count;
+    send.data.pme_batch.len = len;
+    send.data.pme_batch.context = pme_model;
+    send.data.pme_batch.committed = 0;
+
+    if (pme_client_call(MSG_ID_PME, &send, &reply,
+                        PME_IPM_TIMEOUT_TICKS) != 0) {
         printk("FATAL ERROR, ipm timed out\n");
+        return -1;
+    }
+    if (reply.error_code != ERROR_IPM_NONE) {
+        printk("PME: batch failed, error %u\n", reply.error_code);
+        return -1;
+    }
+    if (committed) {
+        *committed = reply.data.pme_batch.committed;
+    }
+    return 0;
+}
+
+// learn count test vectors, one category each, then classify them back
+static int pme_batch_test(uint16_t count)
+{
+    uint16_t committed = 0;
+    uint16_t matched = 0;
+
+    if (count > PME_BATCH_ENTRIES) {
+        count = PME_BATCH_ENTRIES;
+    }
+
+    for (uint16_t i = 0; i < count; i++) {
+        memset(batch_entries[i].vector, i * 4, 4);
+        batch_entries[i].category = i + 1;
+    }
+
+    uint32_t start = k_uptime_get_32();
+    if (pme_send_batch(TYPE_PME_LEARN_BATCH, batch_entries, count, 4,
+                       &committed) != 0) {
+        return ERROR_IPM_OPERATION_FAILED;
+    }
+    uint32_t learned = k_uptime_get_32();
+    if (pme_send_batch(TYPE_PME_CLASSIFY_BATCH, batch_entries, count, 4,
+                       NULL) != 0) {
         return ERROR_IPM_OPERATION_FAILED;
     }
+    uint32_t classified = k_uptime_get_32();
 
+    for (uint16_t i = 0; i < count; i++) {
+        matched += (batch_entries[i].category == i + 1);
+    }
+    printk("PME: %u learned in %u ms (%u neurons), %u of %u classified back "
+           "in %u ms\n", count, learned - start, committed, matched, count,
+           classified - learned);
+    return 0;
+}
+
+static struct k_sem pipeline_sem;
+static uint32_t pipeline_done;
+static uint32_t pipeline_failed;
+// IDs of the last requests sent, replies come back in order so the ones
+// still outstanding are always the most recent
+static uint32_t pipeline_ids[PME_CLIENT_REQUESTS];
+
+static void pme_pipeline_done(zjs_ipm_message_t *reply, void *arg)
+{
+    if (reply->error_code == ERROR_IPM_NONE) {
+        pipeline_done++;
+    } else {
+        pipeline_failed++;
+    }
+    k_sem_give(&pipeline_sem);
+}
+
+// classify count test vectors with as many requests in flight as the ring
+// allows, the IPM round trips overlap with the ARC classifying
+static int pme_pipeline(uint32_t count)
+{
+    zjs_ipm_message_t send;
+    uint32_t sent = 0;
+    uint32_t inflight = 0;
+
+    memset(&send, 0, sizeof(send));
+    send.type = TYPE_PME_CLASSIFY_TEST;
+    send.data.pme.context = pme_model;
+    send.data.pme.count = 4;
+
+    pipeline_done = 0;
+    pipeline_failed = 0;
+    k_sem_init(&pipeline_sem, 0, PME_CLIENT_REQUESTS);
+    uint32_t start = k_uptime_get_32();
+
+    while (sent < count || inflight) {
+        if (sent < count && inflight < PME_CLIENT_REQUESTS) {
+            send.data.pme.vector[0] = sent;
+            send.data.pme.vector[1] = sent >> 8;
+            uint32_t id = pme_client_send(MSG_ID_PME, &send,
+                                          pme_pipeline_done, NULL);
+            if (id) {
+                pipeline_ids[sent % PME_CLIENT_REQUESTS] = id;
+                sent++;
+                inflight++;
+                continue;
+            }
+            if (!inflight) {
+                printk("PME: IPM send failed\n");
+                return ERROR_IPM_OPERATION_FAILED;
+            }
+        }
+        // table or ring full, wait for a reply
+        if (k_sem_take(&pipeline_sem, PME_IPM_TIMEOUT_TICKS)) {
+            printk("FATAL ERROR, ipm timed out\n");
+            // drop what is still in flight, a late reply must not give
+            // the semaphore of the next run
+            for (uint32_t i = 1; i <= inflight; i++) {
+                pme_client_cancel(pipeline_ids[(sent - i) %
+                                               PME_CLIENT_REQUESTS]);
+            }
+            return ERROR_IPM_OPERATION_FAILED;
+        }
+        inflight--;
+    }
+
+    printk("PME: %u classifications in %u ms\n", pipeline_done,
+           k_uptime_get_32() - start);
+    if (pipeline_failed) {
+        printk("PME: %u classifications failed\n", pipeline_failed);
+        return ERROR_IPM_OPERATION_FAILED;
+    }
     return 0;
 }
 
@@ -88,9 +391,10 @@ static int shell_cmd_pme(int argc, char *argv[])
     zjs_ipm_message_t reply;
 
     send.id = MSG_ID_PME;
-    send.flags = 0 | MSG_SYNC_FLAG;
-    send.user_data = (void *)&reply;
+    send.flags = 0;
     send.error_code = ERROR_IPM_NONE;
+    send.data.pme.context = pme_model;
+    send.data.pme.source = pme_source;
 
     if (!strcmp(argv[1], "init")) {
         send.type = TYPE_PME_INIT;
@@ -128,21 +432,89 @@ static int shell_cmd_pme(int argc, char *argv[])
     } else if (!strcmp(argv[1], "classify")) {
         send.type = TYPE_PME_CLASSIFY_IMU;
     } else if (!strcmp(argv[1], "read")) {
-        send.type = TYPE_PME_READ_NEURONS;
+        return pme_read_neurons();
+    } else if (!strcmp(argv[1], "write")) {
+        return pme_write_neurons();
+    } else if (!strcmp(argv[1], "bench")) {
+        send.type = TYPE_PME_BENCH;
+        send.data.pme.count = (argc == 3) ? atoi(argv[2]) : 1000;
+    } else if (!strcmp(argv[1], "batch")) {
+        return pme_batch_test((argc == 3) ? atoi(argv[2]) : PME_BATCH_ENTRIES);
+    } else if (!strcmp(argv[1], "pipeline")) {
+        return pme_pipeline((argc == 3) ? atoi(argv[2]) : 1000);
+    } else if (!strcmp(argv[1], "save")) {
+        // store learned changes now instead of after PME_SAVE_DELAY
+        send.type = TYPE_PME_SAVE;
+    } else if (!strcmp(argv[1], "forget")) {
+        send.type = TYPE_PME_FORGET;
+        pme_model = 0;
+    } else if (!strcmp(argv[1], "segment")) {
+        // classify gestures instead of sliding windows
+        send.type = TYPE_PME_SEGMENT;
+        if (argc != 3) {
+            printk("usage: %s on | off | threshold\n", argv[1]);
+            return 0;
+        } else if (!strcmp(argv[2], "on")) {
+            send.data.pme.count = PME_SEGMENT_DEFAULT;
+        } else if (!strcmp(argv[2], "off")) {
+            send.data.pme.count = 0;
+        } else {
+            send.data.pme.count = atoi(argv[2]);
+        }
+    } else if (!strcmp(argv[1], "window")) {
+        // sliding window length and hop, in samples
+        if (argc != 4) {
+            printk("usage: %s samples hop\n", argv[1]);
+            return 0;
+        }
+        send.type = TYPE_PME_WINDOW;
+        send.data.pme.count = atoi(argv[2]);
+        send.data.pme.category = atoi(argv[3]);
+    } else if (!strcmp(argv[1], "source")) {
+        // sensors of the following learn/classify vectors
+        if (argc == 3 && !strcmp(argv[2], "accel")) {
+            pme_source = PME_DATA_SOURCE_ACCEL;
+        } else if (argc == 3 && !strcmp(argv[2], "gyro")) {
+            pme_source = PME_DATA_SOURCE_GYRO;
+        } else if (argc == 3 && !strcmp(argv[2], "both")) {
+            pme_source = PME_DATA_SOURCE_ACCEL | PME_DATA_SOURCE_GYRO;
+        } else {
+            printk("usage: %s accel | gyro | both\n", argv[1]);
+        }
+        return 0;
+    } else if (!strcmp(argv[1], "model")) {
+        // select a model, or have the ARC assign a new one
+        if (argc == 3) {
+            pme_model = atoi(argv[2]);
+            return 0;
+        }
+        send.type = TYPE_PME_MODEL_CREATE;
     } else {
         printk("shell: invalid usage\n");
         return 0;        
     }
 
-    if (zjs_ipm_send(MSG_ID_PME, &send) != 0) {
-        printk("PME: IPM send failed\n");
-        return ERROR_IPM_OPERATION_FAILED;
-    }
-    if (k_sem_take(&sync_sem, PME_IPM_TIMEOUT_TICKS)) {
+    if (pme_client_call(MSG_ID_PME, &send, &reply,
+                        PME_IPM_TIMEOUT_TICKS) != 0) {
         printk("FATAL ERROR, ipm timed out\n");
         return ERROR_IPM_OPERATION_FAILED;
     }
 
+    if (reply.error_code != ERROR_IPM_NONE) {
+        printk("PME: %s failed, error %lu\n", argv[1], reply.error_code);
+        return reply.error_code;
+    }
+
+    if (send.type == TYPE_PME_CLASSIFY_TEST &&
+        reply.error_code == ERROR_IPM_NONE) {
+        printf("PME: classify category=%d\n", reply.data.pme.category);
+    }
+    if (send.type == TYPE_PME_MODEL_CREATE &&
+        reply.error_code == ERROR_IPM_NONE) {
+        pme_model = reply.data.pme.context;
+        printk("PME: model %d\n", pme_model);
+    }
+
     return 0;
 }
 
@@ -152,20 +524,18 @@ void sensor_ipm_callback(void *context, uint32_t id, volatile void *data)
         printk("PME: IPM invalid ID\n");
         return;
     }
-    zjs_ipm_message_t *msg = (zjs_ipm_message_t*)(*(uintptr_t *)data);
-    if ((msg->flags & MSG_SYNC_FLAG) == MSG_SYNC_FLAG) {
-        zjs_ipm_message_t *result = (zjs_ipm_message_t*)msg->user_data;
-        // synchrounus ipm, copy the results
-        if (result) {
-            memcpy(result, msg, sizeof(zjs_ipm_message_t));
-        }
-        // un-block sync api
-        k_sem_give(&sync_sem);
+    zjs_ipm_message_t *msg = zjs_ipm_receive(id, data);
+    if (!msg) {
+        return;
+    }
+    if (pme_client_complete(msg)) {
+        // reply to a request
     } else if (msg->type == TYPE_SENSOR_EVENT_READING_CHANGE) {
         // value change event,
-        double x = msg->data.sensor.reading.x;
-        double y = msg->data.sensor.reading.y;
-        double z = msg->data.sensor.reading.z;
+        // milli-units
+        double x = msg->data.sensor.reading.x / 1000.0;
+        double y = msg->data.sensor.reading.y / 1000.0;
+        double z = msg->data.sensor.reading.z / 1000.0;
         if (sensor_print)
             printf("PME: sensor val=%f %f %f\n", x, y, z);
     } else {
@@ -179,27 +549,27 @@ void pme_ipm_callback(void *context, uint32_t id, volatile void *data)
         printk("PME: IPM invalid ID\n");
         return;
     }
-    zjs_ipm_message_t *msg = (zjs_ipm_message_t*)(*(uintptr_t *)data);
-    zjs_ipm_message_t *result;
-
-    if ((msg->flags & MSG_SYNC_FLAG) == MSG_SYNC_FLAG) {
-         result = (zjs_ipm_message_t*)msg->user_data;
-        // synchrounus ipm, copy the results
-        if (result) {
-            memcpy(result, msg, sizeof(zjs_ipm_message_t));
-        }
-        // un-block sync api
-        k_sem_give(&sync_sem);
-    } 
+    zjs_ipm_message_t *msg = zjs_ipm_receive(id, data);
+    if (!msg) {
+        return;
+    }
 
-    if (msg->type == TYPE_PME_CLASSIFY_TEST || msg->type == TYPE_PME_CLASSIFY_IMU) {
-        printf("PME: classify category=%d\n", msg->data.pme.category);
-    } 
+    if (pme_client_complete(msg)) {
+        // reply to a request
+    } else if (msg->type == TYPE_PME_EVENT_CLASSIFIED) {
+        // pushed by the ARC when the IMU classification changes
+        printk("PME: window %u at %u ms: category=%d distance=%d nid=%d\n",
+               msg->data.pme_event.window, msg->data.pme_event.timestamp,
+               msg->data.pme_event.category, msg->data.pme_event.distance,
+               msg->data.pme_event.nid);
+    } else {
+        printk("unsupported message received\n");
+    }
 }
 
 static struct shell_cmd commands[] = {
         { "sensor", shell_cmd_sensor, "init start stop print" },
-        { "pme", shell_cmd_pme, "init | learn category | classify" },
+        { "pme", shell_cmd_pme, "init | learn category | classify | read | write | bench [n] | pipeline [n] | batch [n] | save | forget | model [n] | source accel|gyro|both | segment on|off|n | window samples hop" },
         { NULL, NULL, NULL }
 };
 
@@ -207,11 +577,12 @@ void main(void)
 {
     SHELL_REGISTER(PME_SHELL_MODULE, commands);
 
+    pme_client_init();
     zjs_ipm_init();
     zjs_ipm_register_callback(MSG_ID_SENSOR, sensor_ipm_callback);
     zjs_ipm_register_callback(MSG_ID_PME, pme_ipm_callback);
 
-    k_sem_init(&sync_sem, 0, 1);
+    k_sem_init(&chunk_sem, 0, PME_CHUNK_DEPTH);
 
     shell_register_default_module(PME_SHELL_MODULE);
 
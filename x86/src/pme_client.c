@@ -0,0 +1,150 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#include <zephyr.h>
+#include <string.h>
+
+#include "pme_client.h"
+#include "zjs_common.h"
+
+typedef struct pme_request {
+    uint32_t id;                // 0: free
+    pme_client_cb_t callback;
+    void *arg;
+} pme_request_t;
+
+static pme_request_t requests[PME_CLIENT_REQUESTS];
+static uint32_t next_id = 1;
+
+void pme_client_init(void)
+{
+    memset(requests, 0, sizeof(requests));
+}
+
+uint32_t pme_client_send(uint32_t msg_id, zjs_ipm_message_t *msg,
+                         pme_client_cb_t callback, void *arg)
+{
+    pme_request_t *request = NULL;
+    uint32_t id = 0;
+
+    // threads and the IPM callback share the table
+    unsigned int key = irq_lock();
+    for (int i = 0; i < PME_CLIENT_REQUESTS; i++) {
+        if (requests[i].id == 0) {
+            request = &requests[i];
+            id = next_id++;
+            if (next_id == 0) {
+                next_id = 1;
+            }
+            request->id = id;
+            request->callback = callback;
+            request->arg = arg;
+            break;
+        }
+    }
+    irq_unlock(key);
+
+    if (!request) {
+        return 0;
+    }
+
+    uint32_t size = zjs_ipm_msg_size(msg_id, msg);
+    zjs_ipm_message_t *out = zjs_ipm_alloc(size);
+    if (!out) {
+        request->id = 0;
+        return 0;
+    }
+
+    memcpy(out, msg, size);
+    out->id = msg_id;
+    out->flags = (msg->flags & ~MSG_SYNC_FLAG) | MSG_ASYNC_FLAG;
+    out->user_data = (void *)(uintptr_t)id;
+    if (zjs_ipm_commit(msg_id, out) != 0) {
+        request->id = 0;
+        return 0;
+    }
+    return id;
+}
+
+void pme_client_cancel(uint32_t request)
+{
+    unsigned int key = irq_lock();
+    for (int i = 0; i < PME_CLIENT_REQUESTS; i++) {
+        if (requests[i].id == request) {
+            requests[i].id = 0;
+        }
+    }
+    irq_unlock(key);
+}
+
+int pme_client_complete(zjs_ipm_message_t *msg)
+{
+    pme_client_cb_t callback = NULL;
+    void *arg = NULL;
+    uint32_t id = (uint32_t)(uintptr_t)msg->user_data;
+
+    if (!(msg->flags & MSG_ASYNC_FLAG)) {
+        return 0;
+    }
+
+    unsigned int key = irq_lock();
+    for (int i = 0; i < PME_CLIENT_REQUESTS; i++) {
+        if (requests[i].id == id) {
+            callback = requests[i].callback;
+            arg = requests[i].arg;
+            requests[i].id = 0;
+            break;
+        }
+    }
+    irq_unlock(key);
+
+    // the ID is free again before the callback, which may send the next one
+    if (callback) {
+        callback(msg, arg);
+    }
+    return 1;
+}
+
+static void future_done(zjs_ipm_message_t *reply, void *arg)
+{
+    pme_future_t *future = arg;
+
+    if (future->reply) {
+        memcpy(future->reply, reply, zjs_ipm_msg_size(reply->id, reply));
+    }
+    k_sem_give(&future->done);
+}
+
+void pme_future_init(pme_future_t *future, zjs_ipm_message_t *reply)
+{
+    k_sem_init(&future->done, 0, 1);
+    future->reply = reply;
+}
+
+uint32_t pme_client_send_future(uint32_t msg_id, zjs_ipm_message_t *msg,
+                                pme_future_t *future)
+{
+    return pme_client_send(msg_id, msg, future_done, future);
+}
+
+int pme_future_wait(pme_future_t *future, uint32_t request, int32_t timeout)
+{
+    if (k_sem_take(&future->done, timeout)) {
+        pme_client_cancel(request);
+        // the reply may have come in meanwhile
+        return k_sem_take(&future->done, K_NO_WAIT) ? -1 : 0;
+    }
+    return 0;
+}
+
+int pme_client_call(uint32_t msg_id, zjs_ipm_message_t *msg,
+                    zjs_ipm_message_t *reply, int32_t timeout)
+{
+    pme_future_t future;
+
+    pme_future_init(&future, reply);
+    uint32_t request = pme_client_send_future(msg_id, msg, &future);
+    if (!request) {
+        return -1;
+    }
+    return pme_future_wait(&future, request, timeout);
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2016, Intel Corporation.
+
+#ifndef __pme_client_h__
+#define __pme_client_h__
+
+#include <zephyr.h>
+
+#include "zjs_ipm.h"
+
+// Asynchronous requests to the ARC. Every request gets an ID and an entry in
+// a completion table; the ARC echoes the ID back in user_data and the reply
+// completes the entry, so any number of requests (up to the ring size) can
+// be outstanding at once, of any message ID.
+//
+// A request completes either through a callback, run from the IPM callback
+// (interrupt context: copy out what is needed and return), or through a
+// future a thread can wait on.
+
+#define PME_CLIENT_REQUESTS ZJS_IPM_RING_RECORDS  // the ring bounds what is in flight
+
+typedef void (*pme_client_cb_t)(zjs_ipm_message_t *reply, void *arg);
+
+typedef struct pme_future {
+    struct k_sem done;
+    zjs_ipm_message_t *reply;  // filled in on completion
+} pme_future_t;
+
+void pme_client_init(void);
+
+// send msg, returns the request ID (never 0) or 0 if no ring slot or table
+// entry is free
+uint32_t pme_client_send(uint32_t msg_id, zjs_ipm_message_t *msg,
+                         pme_client_cb_t callback, void *arg);
+
+// forget a request, a late reply is dropped
+void pme_client_cancel(uint32_t request);
+
+// complete the request msg replies to, call from the IPM callbacks; returns
+// 0 if msg is not a reply to an async request
+int pme_client_complete(zjs_ipm_message_t *msg);
+
+void pme_future_init(pme_future_t *future, zjs_ipm_message_t *reply);
+uint32_t pme_client_send_future(uint32_t msg_id, zjs_ipm_message_t *msg,
+                                pme_future_t *future);
+// returns 0 once completed, -1 on timeout (the request is cancelled)
+int pme_future_wait(pme_future_t *future, uint32_t request, int32_t timeout);
+
+// send and wait, returns 0 with the reply or -1
+int pme_client_call(uint32_t msg_id, zjs_ipm_message_t *msg,
+                    zjs_ipm_message_t *reply, int32_t timeout);
+
+#endif  // __pme_client_h__
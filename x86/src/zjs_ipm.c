@@ -1,8 +1,10 @@
 // Copyright (c) 2016, Intel Corporation.
 #ifndef QEMU_BUILD
 // ipm for ARC communication
+#include <zephyr.h>
 #include <ipm/ipm_quark_se.h>
 #include <string.h>
+#include <stddef.h>
 
 // ZJS includes
 #include "zjs_ipm.h"
@@ -22,9 +24,36 @@ struct zjs_ipm_callback {
     struct zjs_ipm_callback *next;
 };
 
+struct zjs_ipm_shared {
+    zjs_ipm_ring_t to_arc;
+    zjs_ipm_ring_t to_x86;
+};
+
 static struct device *ipm_send_dev;
 static struct device *ipm_receive_dev;
 
+#ifdef CONFIG_X86
+static struct zjs_ipm_shared ipm_shared;
+static struct zjs_ipm_shared *shared = &ipm_shared;
+#define TX_RING (&shared->to_arc)
+#define RX_RING (&shared->to_x86)
+#else
+// set by the MSG_ID_IPM_ATTACH doorbell from x86
+static struct zjs_ipm_shared *shared = NULL;
+#define TX_RING (&shared->to_x86)
+#define RX_RING (&shared->to_arc)
+#endif
+
+#define RING_MASK (ZJS_IPM_RING_BYTES - 1)
+
+static inline zjs_ipm_record_t *ring_record(zjs_ipm_ring_t *ring, uint32_t offset)
+{
+    return (zjs_ipm_record_t *)((uint8_t *)ring->data + (offset & RING_MASK));
+}
+
+// keep the compiler from moving slot writes past the doorbell
+#define ipm_barrier() __asm__ __volatile__("" ::: "memory")
+
 #ifdef CONFIG_X86
 static struct zjs_ipm_callback *zjs_ipm_callbacks = NULL;
 
@@ -35,6 +64,12 @@ static void zjs_ipm_msg_callback(void *context, uint32_t id, volatile void *data
             cb->callback(context, id, data);
         }
     }
+
+    // callbacks copy out what they need, the record can go back to the ARC
+    zjs_ipm_message_t *msg = zjs_ipm_receive(id, data);
+    if (msg) {
+        zjs_ipm_release(msg);
+    }
 }
 #endif
 
@@ -56,18 +91,188 @@ void zjs_ipm_init()
     // on x86 side, all ipm is routed through a single callback handler
     ipm_register_callback(ipm_receive_dev, zjs_ipm_msg_callback, NULL);
     ipm_set_enabled(ipm_receive_dev, 1);
+
+    // tell the ARC where the rings are, this waits until it has picked it up
+    if (ipm_send_dev) {
+        uint32_t base = (uint32_t)(uintptr_t)shared;
+        ipm_send(ipm_send_dev, 1, MSG_ID_IPM_ATTACH, &base, sizeof(base));
+    }
 #endif
 }
 
-int zjs_ipm_send(uint32_t id, zjs_ipm_message_t *data)
+uint32_t zjs_ipm_msg_size(uint32_t id, const zjs_ipm_message_t *msg)
+{
+    uint32_t payload = sizeof(msg->data);
+    uint32_t count;
+
+    switch (id) {
+    case MSG_ID_AIO:
+        payload = sizeof(struct aio_data);
+        break;
+    case MSG_ID_I2C:
+        payload = sizeof(struct i2c_data);
+        break;
+    case MSG_ID_GLCD:
+        payload = sizeof(struct glcd_data);
+        break;
+    case MSG_ID_SENSOR:
+        payload = sizeof(struct sensor_data);
+        break;
+    case MSG_ID_PME:
+        switch (msg->type) {
+        case TYPE_PME_READ_NEURONS:
+        case TYPE_PME_WRITE_NEURONS:
+            // a read request makes room for the neurons of the reply
+            count = msg->data.pme_chunk.count;
+            if (count > ZJS_PME_CHUNK_NEURONS) {
+                count = ZJS_PME_CHUNK_NEURONS;
+            }
+            payload = offsetof(struct pme_chunk, neuron) +
+                      count * sizeof(struct pme_data);
+            break;
+        case TYPE_PME_LEARN_BATCH:
+        case TYPE_PME_CLASSIFY_BATCH:
+            payload = sizeof(struct pme_batch);
+            break;
+        case TYPE_PME_EVENT_CLASSIFIED:
+            payload = sizeof(struct pme_event);
+            break;
+        case TYPE_PME_LEARN_TEST:
+        case TYPE_PME_CLASSIFY_TEST:
+            count = msg->data.pme.count;
+            if (count > sizeof(msg->data.pme.vector)) {
+                count = sizeof(msg->data.pme.vector);
+            }
+            payload = offsetof(struct pme_data, vector) + count;
+            break;
+        default:
+            payload = offsetof(struct pme_data, vector);
+        }
+        break;
+    }
+
+    return offsetof(zjs_ipm_message_t, data) + payload;
+}
+
+zjs_ipm_message_t *zjs_ipm_alloc(uint32_t size)
+{
+    zjs_ipm_message_t *msg = NULL;
+
+    if (!shared) {
+        ERR_PRINT("ipm rings not attached\n");
+        return NULL;
+    }
+
+    uint32_t need = (sizeof(zjs_ipm_record_t) + size + 3) & ~3;
+    if (need > ZJS_IPM_RING_BYTES / 2) {
+        ERR_PRINT("ipm message too large\n");
+        return NULL;
+    }
+
+    // several threads may send, reserving a record must not be interrupted
+    zjs_ipm_ring_t *ring = TX_RING;
+    unsigned int key = irq_lock();
+
+    // records are contiguous, pad up to the end when one does not fit there
+    uint32_t contiguous = ZJS_IPM_RING_BYTES - (ring->head & RING_MASK);
+    uint32_t pad = (need > contiguous) ? contiguous : 0;
+
+    if (ring->posted - ring->released < ZJS_IPM_RING_RECORDS &&
+        ZJS_IPM_RING_BYTES - (ring->head - ring->tail) >= pad + need) {
+        zjs_ipm_record_t *record;
+        if (pad) {
+            record = ring_record(ring, ring->head);
+            record->size = pad;
+            record->done = ZJS_IPM_RECORD_PAD;
+            ring->head += pad;
+        }
+        record = ring_record(ring, ring->head);
+        record->size = need;
+        record->done = ZJS_IPM_RECORD_BUSY;
+        ring->head += need;
+        ring->posted++;
+        msg = (zjs_ipm_message_t *)(record + 1);
+    }
+    irq_unlock(key);
+
+    return msg;
+}
+
+int zjs_ipm_commit(uint32_t id, zjs_ipm_message_t *msg)
 {
+    zjs_ipm_ring_t *ring = TX_RING;
+    zjs_ipm_record_t *record = (zjs_ipm_record_t *)msg - 1;
+    uint32_t offset = (uint8_t *)record - (uint8_t *)ring->data;
+
     if (!ipm_send_dev) {
         ERR_PRINT("Cannot find outbound ipm device!\n" );
+        record->done = ZJS_IPM_RECORD_DONE;
+        return -1;
+    }
+
+    ipm_barrier();
+    int ret = ipm_send(ipm_send_dev, 1, id, &offset, sizeof(offset));
+    if (ret != 0) {
+        // never delivered, let the consumer skip over it
+        record->done = ZJS_IPM_RECORD_DONE;
+    }
+    return ret;
+}
+
+int zjs_ipm_send(uint32_t id, zjs_ipm_message_t *data)
+{
+    uint32_t size = zjs_ipm_msg_size(id, data);
+    zjs_ipm_message_t *msg = zjs_ipm_alloc(size);
+
+    if (!msg) {
+        ERR_PRINT("no room in the ipm ring, dropping message\n");
         return -1;
     }
 
-    // sending pointer to the address of ipm message
-    return ipm_send(ipm_send_dev, 1, id, &data, sizeof(void *));
+    memcpy(msg, data, size);
+    return zjs_ipm_commit(id, msg);
+}
+
+zjs_ipm_message_t *zjs_ipm_receive(uint32_t id, volatile void *data)
+{
+    uint32_t value = *(volatile uint32_t *)data;
+
+#ifdef CONFIG_ARC
+    if (id == MSG_ID_IPM_ATTACH) {
+        shared = (struct zjs_ipm_shared *)(uintptr_t)value;
+        return NULL;
+    }
+#endif
+
+    if (!shared || value >= ZJS_IPM_RING_BYTES || (value & 3)) {
+        ERR_PRINT("invalid ipm offset %lu\n", value);
+        return NULL;
+    }
+
+    return (zjs_ipm_message_t *)(ring_record(RX_RING, value) + 1);
+}
+
+void zjs_ipm_release(zjs_ipm_message_t *msg)
+{
+    zjs_ipm_ring_t *ring = RX_RING;
+
+    // may be called from the ipm callback as well as from a thread
+    unsigned int key = irq_lock();
+    ((zjs_ipm_record_t *)msg - 1)->done = ZJS_IPM_RECORD_DONE;
+
+    // records may be released out of order, the tail only moves over
+    // contiguous released ones
+    while (ring->tail != ring->head) {
+        zjs_ipm_record_t *record = ring_record(ring, ring->tail);
+        if (record->done == ZJS_IPM_RECORD_BUSY) {
+            break;
+        }
+        if (record->done == ZJS_IPM_RECORD_DONE) {
+            ring->released++;
+        }
+        ring->tail += record->size;
+    }
+    irq_unlock(key);
 }
 
 void zjs_ipm_register_callback(uint32_t msg_id, ipm_callback_t cb)
@@ -15,12 +15,14 @@
 #define MSG_ID_I2C                                         0x02
 #define MSG_ID_GLCD                                        0x03
 #define MSG_ID_SENSOR                                      0x04
+#define MSG_ID_IPM_ATTACH                                  0xFF  // internal
 
 // Message flags
 enum {
      MSG_SYNC_FLAG =                                       0x01,
      MSG_ERROR_FLAG =                                      0x02,
-     MSG_SAFE_TO_FREE_FLAG =                               0x04
+     MSG_SAFE_TO_FREE_FLAG =                               0x04,
+     MSG_ASYNC_FLAG =                                      0x08   // user_data is a request ID
 };
 
 // Error Codes
@@ -79,6 +81,39 @@ enum {
 #define TYPE_PME_CLASSIFY_IMU                              0x0044
 #define TYPE_PME_READ_NEURONS                              0x0045
 #define TYPE_PME_WRITE_NEURONS                             0x0046
+#define TYPE_PME_BENCH                                     0x0047
+#define TYPE_PME_FORGET                                    0x0048
+#define TYPE_PME_MODEL_CREATE                              0x0049
+#define TYPE_PME_SEGMENT                                   0x004A
+#define TYPE_PME_LEARN_BATCH                               0x004B
+#define TYPE_PME_CLASSIFY_BATCH                            0x004C
+#define TYPE_PME_EVENT_CLASSIFIED                          0x004D  // ARC to x86, unsolicited
+#define TYPE_PME_SAVE                                      0x004E
+#define TYPE_PME_WINDOW                                    0x004F
+
+// TYPE_PME_SEGMENT pme.count: motion threshold in feature codes, 0 for
+// sliding windows
+#define PME_SEGMENT_DEFAULT                                0xFFFF  // 0.1G
+
+// TYPE_PME_WINDOW pme.count: sliding window length, pme.category: samples
+// between two windows, both in sensor samples
+
+// sensors feeding TYPE_PME_LEARN_IMU/CLASSIFY_IMU, pme.source
+#define PME_DATA_SOURCE_ACCEL                              0x01
+#define PME_DATA_SOURCE_GYRO                               0x02
+
+// neurons per TYPE_PME_READ_NEURONS/WRITE_NEURONS message, about 140 bytes
+// each
+#ifndef ZJS_PME_CHUNK_NEURONS
+#define ZJS_PME_CHUNK_NEURONS                              4
+#endif
+
+// one vector of TYPE_PME_LEARN_BATCH/CLASSIFY_BATCH
+typedef struct pme_batch_entry {
+    uint8_t  vector[128];
+    uint16_t category;      // learn: input, classify: result
+    uint16_t reserved;
+} pme_batch_entry_t;
 
 typedef struct zjs_ipm_message {
     uint32_t id;
@@ -121,34 +156,107 @@ typedef struct zjs_ipm_message {
             char *controller;
             uint32_t pin;
             uint32_t frequency;
+            // fixed point, milli-units (m/s^2, rad/s, degrees C, lux)
             union sensor_reading {
                 // x y z axis for Accelerometer and Gyroscope
                 struct {
-                    double x;
-                    double y;
-                    double z;
+                    int32_t x;
+                    int32_t y;
+                    int32_t z;
                 };
                 // single value sensors eg. ambient light
-                double dval;
+                int32_t value;
             } reading;
         } sensor;
 
-        // PME
+        // PME, the vector goes last so messages without one stay short
         struct pme_data {
-            uint8_t  vector[128];
             uint16_t count;
             uint16_t category;
-            uint16_t context;
+            uint16_t context;       // neuron context, the model to learn/classify with (0: default)
             uint16_t influence;
             uint16_t minInfluence;
+            uint16_t source;        // PME_DATA_SOURCE_* mask of the IMU vectors (0: accelerometer)
+            uint8_t  vector[128];
         } pme;
+
+        // PME knowledge transfer, TYPE_PME_READ_NEURONS/WRITE_NEURONS. Each
+        // entry carries one neuron, count being its component count.
+        struct pme_chunk {
+            uint16_t first;    // network index of neuron[0]
+            uint16_t count;    // neurons in this chunk
+            uint16_t total;    // committed neurons, set in the reply
+            struct pme_data neuron[ZJS_PME_CHUNK_NEURONS];
+        } pme_chunk;
+
+        // TYPE_PME_LEARN_BATCH/CLASSIFY_BATCH: count vectors in a buffer of
+        // the sender, in memory both cores see like the rings; the classify
+        // results are written back into it before the reply
+        struct pme_batch {
+            pme_batch_entry_t *entries;
+            uint16_t count;
+            uint16_t len;           // vector bytes, the same for all
+            uint16_t context;       // model, 0: default
+            uint16_t committed;     // reply: neurons after learning
+        } pme_batch;
+
+        // TYPE_PME_EVENT_CLASSIFIED, the IMU classification changed
+        struct pme_event {
+            uint16_t category;      // 0x7FFF when nothing fired
+            uint16_t distance;
+            uint16_t nid;
+            uint16_t context;       // model
+            uint32_t timestamp;     // ARC uptime, ms
+            uint32_t window;        // vectors classified since TYPE_PME_CLASSIFY_IMU
+        } pme_event;
     } data;
 } zjs_ipm_message_t;
 
+// Messages travel through a byte ring per direction in memory shared by both
+// cores; the IPM doorbell only carries the offset of the message. Each one
+// takes a record of its header plus the payload of its type (see
+// zjs_ipm_msg_size()), not the whole union, so small messages stay small.
+// The rings are owned by the x86 side, which hands their address to the ARC
+// with a MSG_ID_IPM_ATTACH doorbell from zjs_ipm_init().
+#define ZJS_IPM_RING_BYTES                                 4096  // power of two
+#define ZJS_IPM_RING_RECORDS                               16    // messages in flight
+
+typedef struct zjs_ipm_record {
+    volatile uint16_t size;        // bytes, header included, multiple of 4
+    volatile uint16_t done;        // ZJS_IPM_RECORD_*
+} zjs_ipm_record_t;
+
+#define ZJS_IPM_RECORD_BUSY                                0
+#define ZJS_IPM_RECORD_DONE                                1  // released by the consumer
+#define ZJS_IPM_RECORD_PAD                                 2  // filler up to the ring end
+
+typedef struct zjs_ipm_ring {
+    volatile uint32_t head;        // bytes published by the producer
+    volatile uint32_t tail;        // bytes released by the consumer
+    volatile uint32_t posted;      // records published by the producer
+    volatile uint32_t released;    // records released by the consumer
+    uint32_t data[ZJS_IPM_RING_BYTES / 4];
+} zjs_ipm_ring_t;
+
+// bytes of msg on the wire: the header and the payload its id and type use
+uint32_t zjs_ipm_msg_size(uint32_t id, const zjs_ipm_message_t *msg);
+
 void zjs_ipm_init();
 
+// copies data into the outgoing ring and rings the doorbell
 int zjs_ipm_send(uint32_t id, zjs_ipm_message_t *data);
 
+// zero-copy send: fill the size bytes returned by alloc in place, then
+// commit them
+zjs_ipm_message_t *zjs_ipm_alloc(uint32_t size);
+int zjs_ipm_commit(uint32_t id, zjs_ipm_message_t *msg);
+
+// map a received doorbell to its message, NULL if it carried no message
+zjs_ipm_message_t *zjs_ipm_receive(uint32_t id, volatile void *data);
+
+// hand a received message back to the sender
+void zjs_ipm_release(zjs_ipm_message_t *msg);
+
 void zjs_ipm_register_callback(uint32_t msg_id, ipm_callback_t cb);
 
 void zjs_ipm_free_callbacks();